@@ -0,0 +1,334 @@
+#include "optimizer.hpp"
+#include "../runtime/heap.hpp"
+#include "../runtime/string_table.hpp"
+
+static bool isLiteral(const std::shared_ptr<Expr> &expr) {
+    return std::dynamic_pointer_cast<LiteralExpr>(expr) != nullptr;
+}
+
+static Value literalValue(const std::shared_ptr<Expr> &expr) {
+    return std::static_pointer_cast<LiteralExpr>(expr)->value;
+}
+
+// The value of a binary operator on two constants, or nothing when evaluating it fails.
+static std::optional<Value> fold(TokenType op, Value lhs, Value rhs) {
+    switch (op) {
+        case TokenType::BANG_EQUAL:
+            return Value(!isEqual(lhs, rhs));
+        case TokenType::EQUAL_EQUAL:
+            return Value(isEqual(lhs, rhs));
+        case TokenType::PLUS:
+            if (lhs.isString() && rhs.isString()) {
+                // Constants are kept flat and interned, like the scanner's.
+                return Value(heap().pin(intern(lhs.asString()->flatten() + rhs.asString()->flatten())));
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (!lhs.isNumber() || !rhs.isNumber()) {
+        return std::nullopt;
+    }
+    double a = lhs.asNumber(), b = rhs.asNumber();
+    switch (op) {
+        case TokenType::GREATER:       return Value(a > b);
+        case TokenType::GREATER_EQUAL: return Value(a >= b);
+        case TokenType::LESS:          return Value(a < b);
+        case TokenType::LESS_EQUAL:    return Value(a <= b);
+        case TokenType::PLUS:          return Value(a + b);
+        case TokenType::MINUS:         return Value(a - b);
+        case TokenType::STAR:          return Value(a * b);
+        case TokenType::SLASH:
+            if (b == 0.0) {
+                return std::nullopt;
+            }
+            return Value(a / b);
+        default:
+            return std::nullopt;
+    }
+}
+
+// Stands in for a removed statement where the grammar needs one.
+static std::shared_ptr<Stmt> noop() {
+    return std::make_shared<ExpressionStmt>(std::make_shared<LiteralExpr>(nullptr));
+}
+
+Optimizer::Optimizer() : loopDepth(0), inFunction(false) {}
+
+void Optimizer::optimize(std::vector<std::shared_ptr<Stmt>> &statements) {
+    std::vector<std::shared_ptr<Stmt>> kept;
+    for (auto statement : statements) {
+        auto optimized = optimize(statement);
+        if (!optimized) {
+            continue;
+        }
+        kept.push_back(optimized);
+        if (terminates(optimized)) {
+            break;
+        }
+    }
+    statements = kept;
+}
+
+std::shared_ptr<Expr> Optimizer::optimize(std::shared_ptr<Expr> expr) {
+    this->expr = expr;
+    expr->accept(*this);
+    return this->expr;
+}
+
+std::shared_ptr<Stmt> Optimizer::optimize(std::shared_ptr<Stmt> stmt) {
+    this->stmt = stmt;
+    stmt->accept(*this);
+    return this->stmt;
+}
+
+// Optimizes a statement that cannot be removed from where it is, like the body of a loop.
+std::shared_ptr<Stmt> Optimizer::optimizeBranch(std::shared_ptr<Stmt> stmt) {
+    auto optimized = optimize(stmt);
+    return optimized ? optimized : noop();
+}
+
+void Optimizer::optimizeFunction(std::shared_ptr<FunctionStmt> stmt, bool isMethod) {
+    int savedLoopDepth = loopDepth;
+    bool savedInFunction = inFunction;
+    loopDepth = 0;
+    inFunction = true;
+
+    // Parameters, after the receiver of a method, take the first slots.
+    scopes.push_back({int(isMethod) + int(stmt->parameters.size()), {}, {}});
+    optimize(stmt->body);
+    endScope(stmt->body);
+
+    loopDepth = savedLoopDepth;
+    inFunction = savedInFunction;
+}
+
+// Returns the slot of a name declared in the current scope, in the resolver's order.
+int Optimizer::declare() {
+    return scopes.empty() ? -1 : scopes.back().declared++;
+}
+
+// A local function declaration that is never read becomes a declaration of
+// nil, which keeps the slots of the scope as the resolver assigned them.
+void Optimizer::endScope(std::vector<std::shared_ptr<Stmt>> &statements) {
+    auto &scope = scopes.back();
+    for (auto &statement : statements) {
+        for (auto [function, slot] : scope.functions) {
+            if (statement.get() == function && !scope.read.count(slot)) {
+                statement = std::make_shared<VarStmt>(function->name, nullptr);
+                break;
+            }
+        }
+    }
+    scopes.pop_back();
+}
+
+bool Optimizer::terminates(const std::shared_ptr<Stmt> &stmt) {
+    if (std::dynamic_pointer_cast<ReturnStmt>(stmt)) {
+        return inFunction;
+    }
+    if (std::dynamic_pointer_cast<BreakStmt>(stmt) || std::dynamic_pointer_cast<ContinueStmt>(stmt)) {
+        return loopDepth > 0;
+    }
+    return false;
+}
+
+void Optimizer::visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) {}
+
+void Optimizer::visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) {
+    this->expr = optimize(expr->expr);
+}
+
+void Optimizer::visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) {
+    expr->lhs = optimize(expr->lhs);
+    expr->rhs = optimize(expr->rhs);
+    if (isLiteral(expr->lhs) && isLiteral(expr->rhs)) {
+        if (auto value = fold(expr->op.type, literalValue(expr->lhs), literalValue(expr->rhs))) {
+            this->expr = std::make_shared<LiteralExpr>(*value);
+            return;
+        }
+    }
+    this->expr = expr;
+}
+
+void Optimizer::visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) {
+    expr->lhs = optimize(expr->lhs);
+    if (isLiteral(expr->lhs)) {
+        bool shortCircuits = isTruthy(literalValue(expr->lhs)) == (expr->op.type == TokenType::OR);
+        this->expr = shortCircuits ? expr->lhs : optimize(expr->rhs);
+        return;
+    }
+    expr->rhs = optimize(expr->rhs);
+    this->expr = expr;
+}
+
+void Optimizer::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
+    expr->expr = optimize(expr->expr);
+    this->expr = expr;
+    if (!isLiteral(expr->expr)) {
+        return;
+    }
+    Value value = literalValue(expr->expr);
+    if (expr->op.type == TokenType::BANG) {
+        this->expr = std::make_shared<LiteralExpr>(!isTruthy(value));
+    } else if (expr->op.type == TokenType::MINUS && value.isNumber()) {
+        this->expr = std::make_shared<LiteralExpr>(-value.asNumber());
+    }
+}
+
+void Optimizer::visitVariableExpr(std::shared_ptr<VariableExpr> expr) {
+    if (expr->local.isLocal()) {
+        scopes[scopes.size() - 1 - expr->local.depth].read.insert(expr->local.slot);
+    }
+}
+
+void Optimizer::visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) {
+    expr->expr = optimize(expr->expr);
+    this->expr = expr;
+}
+
+void Optimizer::visitCallExpr(std::shared_ptr<CallExpr> expr) {
+    expr->callee = optimize(expr->callee);
+    // Decided here, once groupings are gone, so that calls need not look.
+    expr->getCallee = dynamic_cast<GetExpr*>(expr->callee.get());
+    for (auto &argument : expr->arguments) {
+        argument = optimize(argument);
+    }
+    this->expr = expr;
+}
+
+void Optimizer::visitGetExpr(std::shared_ptr<GetExpr> expr) {
+    expr->object = optimize(expr->object);
+    this->expr = expr;
+}
+
+void Optimizer::visitSetExpr(std::shared_ptr<SetExpr> expr) {
+    expr->object = optimize(expr->object);
+    expr->value = optimize(expr->value);
+    this->expr = expr;
+}
+
+void Optimizer::visitThisExpr(std::shared_ptr<ThisExpr> expr) {}
+void Optimizer::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {}
+
+void Optimizer::visitBreakStmt(std::shared_ptr<BreakStmt> stmt) {}
+void Optimizer::visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) {}
+
+void Optimizer::visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) {
+    stmt->expr = optimize(stmt->expr);
+    this->stmt = isLiteral(stmt->expr) ? nullptr : stmt;
+}
+
+void Optimizer::visitPrintStmt(std::shared_ptr<PrintStmt> stmt) {
+    stmt->expr = optimize(stmt->expr);
+    this->stmt = stmt;
+}
+
+void Optimizer::visitVarStmt(std::shared_ptr<VarStmt> stmt) {
+    declare();
+    if (stmt->initializer != nullptr) {
+        stmt->initializer = optimize(stmt->initializer);
+    }
+    this->stmt = stmt;
+}
+
+void Optimizer::visitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+    scopes.push_back({0, {}, {}});
+    optimize(stmt->statements);
+    endScope(stmt->statements);
+    this->stmt = stmt;
+}
+
+void Optimizer::visitIfStmt(std::shared_ptr<IfStmt> stmt) {
+    stmt->guard = optimize(stmt->guard);
+    if (isLiteral(stmt->guard)) {
+        auto taken = isTruthy(literalValue(stmt->guard)) ? stmt->then : stmt->elsee;
+        this->stmt = taken ? optimize(taken) : nullptr;
+        return;
+    }
+    stmt->then = optimizeBranch(stmt->then);
+    if (stmt->elsee != nullptr) {
+        stmt->elsee = optimizeBranch(stmt->elsee);
+    }
+    this->stmt = stmt;
+}
+
+void Optimizer::visitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+    stmt->cond = optimize(stmt->cond);
+    if (isLiteral(stmt->cond) && !isTruthy(literalValue(stmt->cond))) {
+        this->stmt = nullptr;
+        return;
+    }
+
+    loopDepth++;
+    stmt->body = optimizeBranch(stmt->body);
+    loopDepth--;
+    this->stmt = stmt;
+}
+
+// Clauses that do nothing are left out. A loop that never runs keeps only
+// its initializer, which still runs once in the loop's scope.
+void Optimizer::visitForStmt(std::shared_ptr<ForStmt> stmt) {
+    scopes.push_back({0, {}, {}});
+    if (stmt->initializer != nullptr) {
+        stmt->initializer = optimize(stmt->initializer);
+    }
+    if (stmt->cond != nullptr) {
+        stmt->cond = optimize(stmt->cond);
+    }
+    if (stmt->cond != nullptr && isLiteral(stmt->cond)) {
+        if (!isTruthy(literalValue(stmt->cond))) {
+            scopes.pop_back();
+            stmt->body = noop();
+            stmt->increment = nullptr;
+            this->stmt = stmt->initializer ? stmt : nullptr;
+            return;
+        }
+        stmt->cond = nullptr;
+    }
+
+    loopDepth++;
+    stmt->body = optimizeBranch(stmt->body);
+    loopDepth--;
+    if (stmt->increment != nullptr) {
+        stmt->increment = optimize(stmt->increment);
+        if (isLiteral(stmt->increment)) {
+            stmt->increment = nullptr;
+        }
+    }
+    scopes.pop_back();
+    this->stmt = stmt;
+}
+
+void Optimizer::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+    int slot = declare();
+    if (slot >= 0) {
+        scopes.back().functions.push_back({stmt.get(), slot});
+    }
+    optimizeFunction(stmt, false);
+    this->stmt = stmt;
+}
+
+void Optimizer::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+    declare();
+    if (stmt->superclass) {
+        optimize(stmt->superclass);
+        scopes.push_back({1, {}, {}});
+    }
+    for (auto method : stmt->methods) {
+        optimizeFunction(method, true);
+    }
+    if (stmt->superclass) {
+        scopes.pop_back();
+    }
+    this->stmt = stmt;
+}
+
+void Optimizer::visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+    if (stmt->expr != nullptr) {
+        stmt->expr = optimize(stmt->expr);
+    }
+    stmt->tailCall = inFunction && std::dynamic_pointer_cast<CallExpr>(stmt->expr) != nullptr;
+    this->stmt = stmt;
+}
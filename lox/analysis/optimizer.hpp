@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../ast/ast.hpp"
+
+// Rewrites the resolved AST before it runs. Operators applied to literals
+// are folded, branches and loops whose condition is a literal are pruned,
+// statements after a return, break or continue are dropped, and local
+// functions nothing refers to are no longer created. Operations that would
+// fail, like a division by zero, are left for the engines to report. Calls
+// whose result a function returns directly are marked as tail calls.
+struct Optimizer : VisitorExpr, VisitorStmt {
+    // Mirrors a scope of the resolver, so that resolved slots can be tracked.
+    struct Scope {
+        int declared;
+        std::set<int> read;
+        std::vector<std::pair<FunctionStmt*, int>> functions;
+    };
+
+    std::vector<Scope> scopes;
+    // Jumps are only pruned after where the engines accept them.
+    int loopDepth;
+    bool inFunction;
+    // Replacement for the node just visited; a null statement is removed.
+    std::shared_ptr<Expr> expr;
+    std::shared_ptr<Stmt> stmt;
+
+    Optimizer();
+
+    void optimize(std::vector<std::shared_ptr<Stmt>> &statements);
+    std::shared_ptr<Expr> optimize(std::shared_ptr<Expr> expr);
+    std::shared_ptr<Stmt> optimize(std::shared_ptr<Stmt> stmt);
+    std::shared_ptr<Stmt> optimizeBranch(std::shared_ptr<Stmt> stmt);
+    void optimizeFunction(std::shared_ptr<FunctionStmt> stmt, bool isMethod);
+
+    int declare();
+    void endScope(std::vector<std::shared_ptr<Stmt>> &statements);
+    bool terminates(const std::shared_ptr<Stmt> &stmt);
+
+    void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override;
+    void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override;
+    void visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) override;
+    void visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) override;
+    void visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) override;
+    void visitVariableExpr(std::shared_ptr<VariableExpr> expr) override;
+    void visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) override;
+    void visitCallExpr(std::shared_ptr<CallExpr> expr) override;
+    void visitGetExpr(std::shared_ptr<GetExpr> expr) override;
+    void visitSetExpr(std::shared_ptr<SetExpr> expr) override;
+    void visitThisExpr(std::shared_ptr<ThisExpr> expr) override;
+    void visitSuperExpr(std::shared_ptr<SuperExpr> expr) override;
+
+    void visitBreakStmt(std::shared_ptr<BreakStmt> stmt) override;
+    void visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) override;
+    void visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override;
+    void visitPrintStmt(std::shared_ptr<PrintStmt> stmt) override;
+    void visitVarStmt(std::shared_ptr<VarStmt> stmt) override;
+    void visitBlockStmt(std::shared_ptr<BlockStmt> stmt) override;
+    void visitIfStmt(std::shared_ptr<IfStmt> stmt) override;
+    void visitWhileStmt(std::shared_ptr<WhileStmt> stmt) override;
+    void visitForStmt(std::shared_ptr<ForStmt> stmt) override;
+    void visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override;
+    void visitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+    void visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
+};
@@ -1,6 +1,6 @@
 #include "resolver.hpp"
 
-Resolver::Resolver(Interpreter &Interpreter, ErrorHandler &errorHandler) : interpreter(Interpreter), errorHandler(errorHandler) {}
+Resolver::Resolver(GlobalTable &globals, ErrorHandler &errorHandler) : globals(globals), errorHandler(errorHandler) {}
 
 void Resolver::resolve(std::shared_ptr<Expr> expr) {
     expr->accept(*this);
@@ -16,12 +16,27 @@ void Resolver::resolve(std::vector<std::shared_ptr<Stmt>> stmts) {
     }
 }
 
-void Resolver::beginScope() {
-    scopes.push_back(std::map<std::string, bool>());
+void Resolver::beginScope(FrameLayout *frame) {
+    scopes.push_back(std::map<std::string, Variable>());
+    frames.push_back(frame);
 }
 
 void Resolver::endScope() {
+    if (frames.back()) {
+        frames.back()->numLocals = scopes.back().size();
+    }
     scopes.pop_back();
+    frames.pop_back();
+}
+
+// A function or class declared here closes over every enclosing scope, so
+// none of their frames may be freed when the scope is left.
+void Resolver::captureFrames() {
+    for (auto frame : frames) {
+        if (frame) {
+            frame->captured = true;
+        }
+    }
 }
 
 void Resolver::declare(Token name) {
@@ -29,22 +44,27 @@ void Resolver::declare(Token name) {
         if (scopes.back().count(name.lexeme)) {
             errorHandler.error(name, "Variable redefined in local scope.");
         }
-        scopes.back()[name.lexeme] = false;
+        // Slots follow declaration order, which is also the order the interpreter defines them in.
+        int slot = scopes.back().size();
+        scopes.back()[name.lexeme] = {false, slot};
     }
 }
 
 void Resolver::define(Token name) {
     if (!scopes.empty()) {
-        scopes.back()[name.lexeme] = true;
+        scopes.back()[name.lexeme].defined = true;
     }
 }
 
-void Resolver::resolveLocal(std::shared_ptr<Expr> expr, Token name) {
+bool Resolver::resolveLocal(LocalSlot &local, const Token &name) {
     for (int i = 0; i < int(scopes.size()); i++) {
-        if (scopes[scopes.size() - 1 - i].count(name.lexeme)) {
-            interpreter.resolve(expr, i);
+        auto &scope = scopes[scopes.size() - 1 - i];
+        if (auto it = scope.find(name.lexeme); it != scope.end()) {
+            local = {i, it->second.slot};
+            return true;
         }
     }
+    return false;
 }
 
 void Resolver::visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) {}
@@ -54,14 +74,18 @@ void Resolver::visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) { resolve(exp
 void Resolver::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) { resolve(expr->expr); }
 
 void Resolver::visitVariableExpr(std::shared_ptr<VariableExpr> expr) {
-    if (!scopes.empty() && scopes.back().count(expr->name.lexeme) && scopes.back()[expr->name.lexeme] == false) {
+    if (!scopes.empty() && scopes.back().count(expr->name.lexeme) && scopes.back()[expr->name.lexeme].defined == false) {
         errorHandler.error(expr->name, "Can't read local variable in its own initializer.");
     }
-    resolveLocal(expr, expr->name);
+    if (!resolveLocal(expr->local, expr->name)) {
+        expr->global = globals.slot(expr->name.identifier());
+    }
 }
 
 void Resolver::visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) {
-    resolveLocal(expr, expr->name);
+    if (!resolveLocal(expr->local, expr->name)) {
+        expr->global = globals.slot(expr->name.identifier());
+    }
     resolve(expr->expr);
 }
 
@@ -82,11 +106,11 @@ void Resolver::visitSetExpr(std::shared_ptr<SetExpr> expr) {
 }
 
 void Resolver::visitThisExpr(std::shared_ptr<ThisExpr> expr) {
-    resolveLocal(expr, expr->keyword);
+    resolveLocal(expr->local, expr->keyword);
 }
 
 void Resolver::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {
-    resolveLocal(expr, expr->keyword);
+    resolveLocal(expr->local, expr->keyword);
 }
 
 void Resolver::visitBreakStmt(std::shared_ptr<BreakStmt> stmt) {}
@@ -103,7 +127,7 @@ void Resolver::visitVarStmt(std::shared_ptr<VarStmt> expr) {
 }
 
 void Resolver::visitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
-    beginScope();
+    beginScope(&stmt->frame);
     resolve(stmt->statements);
     endScope();
 }
@@ -121,10 +145,36 @@ void Resolver::visitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
     resolve(stmt->body);
 }
 
+// The loop gets one scope for the variable of its initializer, which the
+// condition, body and increment all see.
+void Resolver::visitForStmt(std::shared_ptr<ForStmt> stmt) {
+    beginScope(&stmt->frame);
+    if (stmt->initializer != nullptr) {
+        resolve(stmt->initializer);
+    }
+    if (stmt->cond != nullptr) {
+        resolve(stmt->cond);
+    }
+    resolve(stmt->body);
+    if (stmt->increment != nullptr) {
+        resolve(stmt->increment);
+    }
+    endScope();
+}
+
 void Resolver::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
     declare(stmt->name);
     define(stmt->name);
-    beginScope();
+    resolveFunction(stmt, false);
+}
+
+void Resolver::resolveFunction(std::shared_ptr<FunctionStmt> stmt, bool isMethod) {
+    captureFrames();
+    beginScope(&stmt->frame);
+    if (isMethod) {
+        // The receiver is passed in the first slot of the method's own frame.
+        scopes.back()["this"] = {true, 0};
+    }
     for (auto parameter : stmt->parameters) {
         declare(parameter);
         define(parameter);
@@ -136,6 +186,7 @@ void Resolver::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
 void Resolver::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
     declare(stmt->name);
     define(stmt->name);
+    captureFrames();
 
     if (stmt->superclass && stmt->name.lexeme == stmt->superclass->name.lexeme) {
         errorHandler.error(stmt->superclass->name, "A class can't inherit from itself.");
@@ -147,15 +198,12 @@ void Resolver::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
 
     if (stmt->superclass) {
         beginScope();
-        scopes.back()["super"] = true;
+        scopes.back()["super"] = {true, 0};
     }
 
-    beginScope();
-    scopes.back()["this"] = true;
     for (auto method : stmt->methods) {
-        resolve(method);
+        resolveFunction(method, true);
     }
-    endScope();
 
     if (stmt->superclass) {
         endScope();
@@ -1,24 +1,33 @@
 #include "../ast/ast.hpp"
-#include "../interpreter/interpreter.hpp"
+#include "../interpreter/globals.hpp"
 #include "../error/error_handler.hpp"
 
 struct Resolver : VisitorExpr, VisitorStmt {
-    Interpreter &interpreter;
+    GlobalTable &globals;
     ErrorHandler &errorHandler;
-    std::vector<std::map<std::string, bool>> scopes;
+    struct Variable {
+        bool defined;
+        int slot;
+    };
 
-    Resolver(Interpreter &interpreter, ErrorHandler &errorHandler);
+    std::vector<std::map<std::string, Variable>> scopes;
+    // Layout of the runtime frame backing each scope, null for the implicit 'this' and 'super' scopes.
+    std::vector<FrameLayout*> frames;
+
+    Resolver(GlobalTable &globals, ErrorHandler &errorHandler);
 
     void resolve(std::shared_ptr<Expr> expr);
     void resolve(std::shared_ptr<Stmt> stmt);
     void resolve(std::vector<std::shared_ptr<Stmt>> stmts);
-    void resolveLocal(std::shared_ptr<Expr> expr, Token name);
+    bool resolveLocal(LocalSlot &local, const Token &name);
 
     void declare(Token token);
     void define(Token token);
 
-    void beginScope();
+    void beginScope(FrameLayout *frame = nullptr);
     void endScope();
+    void captureFrames();
+    void resolveFunction(std::shared_ptr<FunctionStmt> stmt, bool isMethod);
 
     void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override;
     void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override;
@@ -41,6 +50,7 @@ struct Resolver : VisitorExpr, VisitorStmt {
     void visitBlockStmt(std::shared_ptr<BlockStmt>) override;
     void visitIfStmt(std::shared_ptr<IfStmt>) override;
     void visitWhileStmt(std::shared_ptr<WhileStmt>) override;
+    void visitForStmt(std::shared_ptr<ForStmt>) override;
     void visitFunctionStmt(std::shared_ptr<FunctionStmt>) override;
     void visitClassStmt(std::shared_ptr<ClassStmt>) override;
     void visitReturnStmt(std::shared_ptr<ReturnStmt>) override;
@@ -0,0 +1,276 @@
+#include "type_inference.hpp"
+
+TypeInference::TypeInference(TypeStats &stats) : nextVariable(0), changed(false), type(Type::UNKNOWN), stats(stats) {}
+
+void TypeInference::infer(const std::vector<std::shared_ptr<Stmt>> &statements) {
+    numeric.clear();
+    do {
+        changed = false;
+        nextVariable = 0;
+        walk = TypeStats();
+        reads.assign(numeric.size(), 0);
+        assignments.assign(numeric.size(), 0);
+        inferBody(statements);
+    } while (changed);
+    stats.operations += walk.operations;
+    stats.specialized += walk.specialized;
+}
+
+TypeInference::Type TypeInference::infer(std::shared_ptr<Expr> expr) {
+    type = Type::UNKNOWN;
+    expr->accept(*this);
+    return type;
+}
+
+void TypeInference::infer(std::shared_ptr<Stmt> stmt) {
+    stmt->accept(*this);
+}
+
+void TypeInference::inferBody(const std::vector<std::shared_ptr<Stmt>> &statements) {
+    for (auto statement : statements) {
+        infer(statement);
+    }
+}
+
+void TypeInference::inferFunction(std::shared_ptr<FunctionStmt> stmt, bool isMethod) {
+    scopes.push_back({});
+    if (isMethod) {
+        declare(false);
+    }
+    for (size_t i = 0; i < stmt->parameters.size(); i++) {
+        declare(false);
+    }
+    inferBody(stmt->body);
+    scopes.pop_back();
+}
+
+// Gives the next slot of the current scope a variable, in the resolver's order.
+int TypeInference::declare(bool mayBeNumeric) {
+    if (scopes.empty()) {
+        return -1;
+    }
+    int variable = -1;
+    if (mayBeNumeric) {
+        variable = nextVariable++;
+        if (variable == int(numeric.size())) {
+            numeric.push_back(true);
+            reads.push_back(0);
+            assignments.push_back(0);
+        }
+    }
+    scopes.back().push_back(variable);
+    return variable;
+}
+
+int TypeInference::variable(LocalSlot local) {
+    if (!local.isLocal()) {
+        return -1;
+    }
+    auto &scope = scopes[scopes.size() - 1 - local.depth];
+    return local.slot < int(scope.size()) ? scope[local.slot] : -1;
+}
+
+void TypeInference::assign(int variable, Type type) {
+    if (variable >= 0 && type != Type::NUMBER && numeric[variable]) {
+        numeric[variable] = false;
+        changed = true;
+    }
+}
+
+// Marks an operator numeric when its operands are proven numbers.
+TypeInference::Type TypeInference::specialize(bool &numeric, bool operandsNumeric, Type result) {
+    numeric = operandsNumeric;
+    walk.operations++;
+    walk.specialized += operandsNumeric;
+    return result;
+}
+
+void TypeInference::visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) {
+    type = expr->value.isNumber() ? Type::NUMBER : Type::UNKNOWN;
+}
+
+void TypeInference::visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) {
+    type = infer(expr->expr);
+}
+
+void TypeInference::visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) {
+    bool numbers = (infer(expr->lhs) == Type::NUMBER) & (infer(expr->rhs) == Type::NUMBER);
+    switch (expr->op.type) {
+        case TokenType::PLUS:
+            // Strings can be added too.
+            type = specialize(expr->numeric, numbers, numbers ? Type::NUMBER : Type::UNKNOWN);
+            break;
+        case TokenType::MINUS:
+        case TokenType::STAR:
+        case TokenType::SLASH:
+            // Anything else is an error.
+            type = specialize(expr->numeric, numbers, Type::NUMBER);
+            break;
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+            type = specialize(expr->numeric, numbers, Type::UNKNOWN);
+            break;
+        default:
+            type = Type::UNKNOWN;
+            break;
+    }
+}
+
+void TypeInference::visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) {
+    bool numbers = (infer(expr->lhs) == Type::NUMBER) & (infer(expr->rhs) == Type::NUMBER);
+    type = numbers ? Type::NUMBER : Type::UNKNOWN;
+}
+
+void TypeInference::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
+    bool number = infer(expr->expr) == Type::NUMBER;
+    if (expr->op.type == TokenType::MINUS) {
+        type = specialize(expr->numeric, number, Type::NUMBER);
+    } else {
+        type = Type::UNKNOWN;
+    }
+}
+
+void TypeInference::visitVariableExpr(std::shared_ptr<VariableExpr> expr) {
+    int variable = this->variable(expr->local);
+    if (variable >= 0) {
+        reads[variable]++;
+    }
+    type = (variable >= 0 && numeric[variable]) ? Type::NUMBER : Type::UNKNOWN;
+}
+
+void TypeInference::visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) {
+    Type value = infer(expr->expr);
+    int variable = this->variable(expr->local);
+    if (variable >= 0) {
+        assignments[variable]++;
+    }
+    assign(variable, value);
+    type = value;
+}
+
+void TypeInference::visitCallExpr(std::shared_ptr<CallExpr> expr) {
+    infer(expr->callee);
+    for (auto argument : expr->arguments) {
+        infer(argument);
+    }
+    type = Type::UNKNOWN;
+}
+
+void TypeInference::visitGetExpr(std::shared_ptr<GetExpr> expr) {
+    infer(expr->object);
+    type = Type::UNKNOWN;
+}
+
+void TypeInference::visitSetExpr(std::shared_ptr<SetExpr> expr) {
+    infer(expr->object);
+    type = infer(expr->value);
+}
+
+void TypeInference::visitThisExpr(std::shared_ptr<ThisExpr> expr) {
+    type = Type::UNKNOWN;
+}
+
+void TypeInference::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {
+    type = Type::UNKNOWN;
+}
+
+void TypeInference::visitBreakStmt(std::shared_ptr<BreakStmt> stmt) {}
+void TypeInference::visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) {}
+void TypeInference::visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) { infer(stmt->expr); }
+void TypeInference::visitPrintStmt(std::shared_ptr<PrintStmt> stmt) { infer(stmt->expr); }
+
+void TypeInference::visitVarStmt(std::shared_ptr<VarStmt> stmt) {
+    int variable = declare(true);
+    // Without an initializer the variable starts out nil.
+    assign(variable, stmt->initializer ? infer(stmt->initializer) : Type::UNKNOWN);
+}
+
+void TypeInference::visitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+    scopes.push_back({});
+    inferBody(stmt->statements);
+    scopes.pop_back();
+}
+
+void TypeInference::visitIfStmt(std::shared_ptr<IfStmt> stmt) {
+    infer(stmt->guard);
+    infer(stmt->then);
+    if (stmt->elsee != nullptr) {
+        infer(stmt->elsee);
+    }
+}
+
+void TypeInference::visitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+    infer(stmt->cond);
+    infer(stmt->body);
+}
+
+void TypeInference::visitForStmt(std::shared_ptr<ForStmt> stmt) {
+    scopes.push_back({});
+    if (stmt->initializer != nullptr) {
+        infer(stmt->initializer);
+    }
+    if (stmt->cond != nullptr) {
+        infer(stmt->cond);
+    }
+    infer(stmt->body);
+    if (stmt->increment != nullptr) {
+        infer(stmt->increment);
+    }
+    int counter = scopes.back().empty() ? -1 : scopes.back()[0];
+    stmt->counted = isCounted(*stmt, counter);
+    // The condition and the increment read it once each.
+    stmt->counterRead = stmt->counted && reads[counter] > 2;
+    scopes.pop_back();
+}
+
+static bool isCounter(const std::shared_ptr<Expr> &expr) {
+    auto variable = std::dynamic_pointer_cast<VariableExpr>(expr);
+    return variable && variable->local.depth == 0 && variable->local.slot == 0;
+}
+
+bool TypeInference::isCounted(const ForStmt &stmt, int counter) {
+    if (counter < 0 || !numeric[counter] || assignments[counter] != 1 || stmt.frame.captured) {
+        return false;
+    }
+    auto cond = std::dynamic_pointer_cast<BinaryExpr>(stmt.cond);
+    if (!cond || (cond->op.type != TokenType::LESS && cond->op.type != TokenType::LESS_EQUAL) || !isCounter(cond->lhs)) {
+        return false;
+    }
+    auto increment = std::dynamic_pointer_cast<AssignmentExpr>(stmt.increment);
+    if (!increment || increment->local.depth != 0 || increment->local.slot != 0) {
+        return false;
+    }
+    auto sum = std::dynamic_pointer_cast<BinaryExpr>(increment->expr);
+    if (!sum || sum->op.type != TokenType::PLUS || !isCounter(sum->lhs)) {
+        return false;
+    }
+    auto step = std::dynamic_pointer_cast<LiteralExpr>(sum->rhs);
+    return step && step->value.isNumber();
+}
+
+void TypeInference::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+    declare(false);
+    inferFunction(stmt, false);
+}
+
+void TypeInference::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+    declare(false);
+    if (stmt->superclass) {
+        infer(stmt->superclass);
+        scopes.push_back({-1});
+    }
+    for (auto method : stmt->methods) {
+        inferFunction(method, true);
+    }
+    if (stmt->superclass) {
+        scopes.pop_back();
+    }
+}
+
+void TypeInference::visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+    if (stmt->expr != nullptr) {
+        infer(stmt->expr);
+    }
+}
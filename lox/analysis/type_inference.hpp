@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../ast/ast.hpp"
+
+struct TypeStats {
+    // Arithmetic and comparison operators, and those proven to only see numbers.
+    int operations = 0;
+    int specialized = 0;
+
+    void print(std::ostream &out) const {
+        out << "[types] " << specialized << " of " << operations << " numeric operations specialized\n";
+    }
+};
+
+// Proves which operators only ever get numbers and marks them numeric, so
+// the engines can skip the operand checks. Numeric literals, arithmetic
+// results and locals whose every assignment is a number are numbers;
+// parameters, globals, fields and call results are not known. Locals start
+// out assumed numeric and the tree is walked again until no assumption is
+// withdrawn.
+//
+// For loops of the form for (var i = <number>; i < <limit>; i = i + <step>),
+// whose counter is assigned nowhere else and cannot be captured, are marked
+// counted, so the interpreter can keep the counter in a native double.
+struct TypeInference : VisitorExpr, VisitorStmt {
+    enum class Type {
+        UNKNOWN,
+        NUMBER
+    };
+
+    // Variable of each slot of a resolver scope, -1 for ones never numeric.
+    std::vector<std::vector<int>> scopes;
+    // Whether each local may still be numeric, by the order of declarations.
+    std::vector<bool> numeric;
+    // Reads of and assignments to each local in the current walk, declarations aside.
+    std::vector<int> reads;
+    std::vector<int> assignments;
+    int nextVariable;
+    bool changed;
+    // Counts of the current walk.
+    TypeStats walk;
+    Type type;
+    TypeStats &stats;
+
+    TypeInference(TypeStats &stats);
+
+    void infer(const std::vector<std::shared_ptr<Stmt>> &statements);
+    Type infer(std::shared_ptr<Expr> expr);
+    void infer(std::shared_ptr<Stmt> stmt);
+    void inferBody(const std::vector<std::shared_ptr<Stmt>> &statements);
+    void inferFunction(std::shared_ptr<FunctionStmt> stmt, bool isMethod);
+
+    int declare(bool mayBeNumeric);
+    int variable(LocalSlot local);
+    void assign(int variable, Type type);
+    Type specialize(bool &numeric, bool operandsNumeric, Type result);
+    bool isCounted(const ForStmt &stmt, int counter);
+
+    void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override;
+    void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override;
+    void visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) override;
+    void visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) override;
+    void visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) override;
+    void visitVariableExpr(std::shared_ptr<VariableExpr> expr) override;
+    void visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) override;
+    void visitCallExpr(std::shared_ptr<CallExpr> expr) override;
+    void visitGetExpr(std::shared_ptr<GetExpr> expr) override;
+    void visitSetExpr(std::shared_ptr<SetExpr> expr) override;
+    void visitThisExpr(std::shared_ptr<ThisExpr> expr) override;
+    void visitSuperExpr(std::shared_ptr<SuperExpr> expr) override;
+
+    void visitBreakStmt(std::shared_ptr<BreakStmt> stmt) override;
+    void visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) override;
+    void visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override;
+    void visitPrintStmt(std::shared_ptr<PrintStmt> stmt) override;
+    void visitVarStmt(std::shared_ptr<VarStmt> stmt) override;
+    void visitBlockStmt(std::shared_ptr<BlockStmt> stmt) override;
+    void visitIfStmt(std::shared_ptr<IfStmt> stmt) override;
+    void visitWhileStmt(std::shared_ptr<WhileStmt> stmt) override;
+    void visitForStmt(std::shared_ptr<ForStmt> stmt) override;
+    void visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override;
+    void visitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+    void visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
+};
@@ -0,0 +1,176 @@
+#include "runtime.hpp"
+
+#include <sys/resource.h>
+
+AotRuntime runtime;
+
+AotRuntime::AotRuntime() : globalNames(nullptr) {
+    // Nil is all zero bits, so the pages are only touched once the stack grows into them.
+    stack = static_cast<Value*>(calloc(STACK_MAX, sizeof(Value)));
+    stackEnd = stack + STACK_MAX;
+    highWater = stack;
+    // What is left of the native stack, less room for natives and the runtime.
+    rlimit limit;
+    getrlimit(RLIMIT_STACK, &limit);
+    nativeBase = static_cast<char*>(__builtin_frame_address(0));
+    nativeLimit = (limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : limit.rlim_cur - std::min<size_t>(limit.rlim_cur / 2, 1 << 20));
+    heap().addRoots(this);
+}
+
+void AotRuntime::init(int numGlobals, const char *const *names) {
+    globals.assign(numGlobals, Value());
+    defined.assign(numGlobals, false);
+    globalNames = names;
+}
+
+void AotRuntime::defineNative(int slot, const char *name, int arity, AotNativeFn function) {
+    defineGlobal(slot, heap().allocate<AotNative>(name, arity, function));
+}
+
+void AotRuntime::markRoots(Heap &heap) {
+    for (auto &global : globals) {
+        heap.markValue(global);
+    }
+    for (Value *slot = stack; slot < highWater; slot++) {
+        heap.markValue(*slot);
+    }
+}
+
+void runtimeError(int line, const std::string &where, const std::string &message) {
+    std::cout.flush();
+    std::cerr << "[line " << line << "] Error " + where + ": " << message << "\n";
+    exit(65);
+}
+
+void arityError(int line, int arity, int argCount) {
+    runtimeError(line, "(", "Expected " + std::to_string(arity) + " parameters, but got " + std::to_string(argCount) + "arguments.");
+}
+
+void undefinedProperty(int line, ObjString *name) {
+    runtimeError(line, name->chars, "Undefined property '" + name->chars + "'.");
+}
+
+// Calls anything but a plain function, with the callee in base[0].
+Value callValue(Value *base, int argCount, int line) {
+    if (base->isObj()) {
+        switch (base->asObj()->type) {
+            case ObjType::AOT_FUNCTION:
+                return callFunction(base->asObj<AotFunction>(), base + 1, argCount, line);
+            case ObjType::AOT_BOUND_METHOD: {
+                auto bound = base->asObj<AotBoundMethod>();
+                *base = bound->receiver;
+                return callFunction(bound->method, base, argCount, line);
+            }
+            case ObjType::AOT_CLASS: {
+                auto klass = base->asObj<AotClass>();
+                auto instance = heap().allocate<AotInstance>(klass);
+                *base = instance;
+                if (klass->initializer) {
+                    callFunction(klass->initializer, base, argCount, line);
+                } else if (argCount != 0) {
+                    arityError(line, 0, argCount);
+                }
+                return instance;
+            }
+            case ObjType::AOT_NATIVE: {
+                auto native = base->asObj<AotNative>();
+                if (native->arity != argCount) {
+                    arityError(line, native->arity, argCount);
+                }
+                return native->function(argCount, base + 1);
+            }
+            default:
+                break;
+        }
+    }
+    runtimeError(line, "(", "Can only call functions and classes.");
+}
+
+// Fields shadow methods.
+static AotCache &lookUp(AotInstance *instance, ObjString *name, AotCache &cache, int line) {
+    if (!cache.hit(instance->shape)) {
+        int index = instance->shape->lookup(name);
+        AotFunction *method = (index < 0 ? instance->klass->findMethod(name) : nullptr);
+        if (index < 0 && !method) {
+            undefinedProperty(line, name);
+        }
+        cache.shape = instance->shape;
+        cache.index = index;
+        cache.method = method;
+    }
+    return cache;
+}
+
+Value getProperty(Value object, ObjString *name, AotCache &cache, int line) {
+    requireInstance(object, name, line);
+    auto instance = object.asObj<AotInstance>();
+    AotCache &entry = lookUp(instance, name, cache, line);
+    if (entry.index >= 0) {
+        return instance->fields[entry.index];
+    }
+    return heap().allocate<AotBoundMethod>(instance, entry.method);
+}
+
+// The object was checked by requireInstance before the value was evaluated.
+void setProperty(Value object, ObjString *name, Value value, AotCache &cache) {
+    auto instance = object.asObj<AotInstance>();
+    if (!cache.hit(instance->shape)) {
+        Shape *shape = instance->shape;
+        int index = shape->lookup(name);
+        cache.shape = shape;
+        cache.index = (index >= 0 ? index : shape->numFields());
+        cache.transition = (index >= 0 ? nullptr : shape->transition(name));
+    }
+    if (cache.transition) {
+        instance->shape = cache.transition;
+        instance->fields.push_back(value);
+        heap().bytesAllocated += sizeof(Value);
+    } else {
+        instance->fields[cache.index] = value;
+    }
+}
+
+// Looks up a property about to be called on the receiver in base[0]. A
+// method is returned to be invoked without binding it, with the receiver
+// left in place; a field replaces the receiver and nil is returned.
+Value lookUpMethod(Value *base, ObjString *name, AotCache &cache, int line) {
+    requireInstance(*base, name, line);
+    auto instance = base->asObj<AotInstance>();
+    AotCache &entry = lookUp(instance, name, cache, line);
+    if (entry.index >= 0) {
+        *base = instance->fields[entry.index];
+        return Value();
+    }
+    return entry.method;
+}
+
+Value getSuper(Value superclass, Value receiver, ObjString *name, int line) {
+    AotFunction *method = superclass.asObj<AotClass>()->findMethod(name);
+    if (!method) {
+        runtimeError(line, name->chars, "Undefined property " + name->chars + ".");
+    }
+    return heap().allocate<AotBoundMethod>(receiver.asObj<AotInstance>(), method);
+}
+
+AotClass *newClass(const char *name, Value superclass, const char *superName, int line) {
+    if (superName && !superclass.isObjType(ObjType::AOT_CLASS)) {
+        runtimeError(line, superName, "Superclass must be a class.");
+    }
+    auto klass = heap().allocate<AotClass>(name);
+    if (superName) {
+        klass->methods = superclass.asObj<AotClass>()->methods;
+        klass->initializer = superclass.asObj<AotClass>()->initializer;
+    }
+    return klass;
+}
+
+void defineMethod(AotClass *klass, ObjString *name, AotFunction *method) {
+    klass->methods[name] = method;
+    if (name == names().init) {
+        klass->initializer = method;
+    }
+}
+
+void print(Value value) {
+    std::cout << stringify(value) << "\n";
+}
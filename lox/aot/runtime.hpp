@@ -0,0 +1,355 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "../runtime/heap.hpp"
+#include "../runtime/shape.hpp"
+#include "../runtime/string_table.hpp"
+
+// Runtime library of programs translated to C++ by tools/lox2cpp. It shares
+// values, strings, shapes and the collector with the interpreters.
+//
+// Every function works on a window of one value stack: its arguments (the
+// receiver first for methods) followed by its locals and temporaries. A call
+// puts the callee and the arguments in consecutive slots of the caller's
+// window, and the callee's window starts at the first argument. Windows are
+// cleared when a function returns, so the whole stack below the high-water
+// mark only ever holds live or nil values and can be scanned as a root.
+
+struct AotFunction;
+
+typedef Value (*AotCode)(AotFunction *self, Value *frame);
+
+// Emitted once per function declaration.
+struct AotProto {
+    AotCode code;
+    const char *name;
+    int arity;
+    // Slots used by the function's window.
+    int frameSize;
+};
+
+// Frame of a scope whose variables are captured by closures.
+struct AotEnvironment : Obj {
+    AotEnvironment *enclosing;
+    int count;
+    Value *values;
+
+    AotEnvironment(AotEnvironment *enclosing, int count) : Obj(ObjType::AOT_ENVIRONMENT), enclosing(enclosing), count(count) {
+        values = reinterpret_cast<Value*>(this + 1);
+        std::uninitialized_fill_n(values, count, Value());
+    }
+
+    static AotEnvironment *create(AotEnvironment *enclosing, int count) {
+        return heap().allocateSized<AotEnvironment>(sizeof(AotEnvironment) + count * sizeof(Value), enclosing, count);
+    }
+
+    // Memory for the values comes from the same allocation.
+    static void operator delete(void *memory) {
+        ::operator delete(memory);
+    }
+
+    std::string toString() override {
+        return "<environment>";
+    }
+
+    size_t size() const override {
+        return sizeof(AotEnvironment) + count * sizeof(Value);
+    }
+
+    void trace(Heap &heap) override {
+        for (int i = 0; i < count; i++) {
+            heap.markValue(values[i]);
+        }
+        heap.markObject(enclosing);
+    }
+};
+
+struct AotFunction : Obj {
+    const AotProto *proto;
+    AotEnvironment *closure;
+
+    AotFunction(const AotProto *proto, AotEnvironment *closure) : Obj(ObjType::AOT_FUNCTION), proto(proto), closure(closure) {}
+
+    std::string toString() override {
+        return "<fn " + std::string(proto->name) + ">";
+    }
+
+    size_t size() const override {
+        return sizeof(AotFunction);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(closure);
+    }
+};
+
+typedef Value (*AotNativeFn)(int argCount, Value *args);
+
+struct AotNative : Obj {
+    std::string name;
+    int arity;
+    AotNativeFn function;
+
+    AotNative(std::string name, int arity, AotNativeFn function) : Obj(ObjType::AOT_NATIVE), name(name), arity(arity), function(function) {}
+
+    std::string toString() override {
+        return "<native " + name + " fn>";
+    }
+
+    size_t size() const override {
+        return sizeof(AotNative);
+    }
+};
+
+struct AotClass : Obj {
+    std::string name;
+    // Own and inherited methods.
+    std::unordered_map<ObjString*, AotFunction*, ObjStringHash> methods;
+    AotFunction *initializer;
+    Shape *rootShape;
+
+    AotClass(std::string name) : Obj(ObjType::AOT_CLASS), name(name), initializer(nullptr) {
+        rootShape = heap().allocate<Shape>(nullptr, nullptr);
+    }
+
+    AotFunction *findMethod(ObjString *name) {
+        auto it = methods.find(name);
+        return it != methods.end() ? it->second : nullptr;
+    }
+
+    std::string toString() override {
+        return "<class " + name + ">";
+    }
+
+    size_t size() const override {
+        return sizeof(AotClass) + methods.size() * sizeof(std::pair<ObjString*, AotFunction*>);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(rootShape);
+        heap.markObject(initializer);
+        for (auto &[methodName, method] : methods) {
+            heap.markObject(methodName);
+            heap.markObject(method);
+        }
+    }
+};
+
+// Fields are stored by the index their shape assigns.
+struct AotInstance : Obj {
+    AotClass *klass;
+    Shape *shape;
+    std::vector<Value> fields;
+
+    AotInstance(AotClass *klass) : Obj(ObjType::AOT_INSTANCE), klass(klass), shape(klass->rootShape) {}
+
+    std::string toString() override {
+        return "<" + klass->name + " object>";
+    }
+
+    size_t size() const override {
+        return sizeof(AotInstance) + fields.capacity() * sizeof(Value);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(klass);
+        heap.markObject(shape);
+        for (auto &field : fields) {
+            heap.markValue(field);
+        }
+    }
+};
+
+struct AotBoundMethod : Obj {
+    AotInstance *receiver;
+    AotFunction *method;
+
+    AotBoundMethod(AotInstance *receiver, AotFunction *method) : Obj(ObjType::AOT_BOUND_METHOD), receiver(receiver), method(method) {}
+
+    std::string toString() override {
+        return method->toString();
+    }
+
+    size_t size() const override {
+        return sizeof(AotBoundMethod);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(receiver);
+        heap.markObject(method);
+    }
+};
+
+// Monomorphic cache of one property access site, emptied by collections
+// like the interpreter's inline caches.
+struct AotCache {
+    Shape *shape = nullptr;
+    // Field index, or -1 for a method.
+    int index = -1;
+    AotFunction *method = nullptr;
+    // For an assignment that adds the field, the shape after adding it.
+    Shape *transition = nullptr;
+    size_t epoch = 0;
+
+    bool hit(Shape *current) {
+        if (epoch != heap().stats.collections) {
+            epoch = heap().stats.collections;
+            shape = nullptr;
+        }
+        return shape == current;
+    }
+};
+
+struct AotRuntime : GcRoots {
+    static const int FRAMES_MAX = 10000;
+    static const int STACK_MAX = FRAMES_MAX * 256;
+
+    Value *stack;
+    Value *stackEnd;
+    // End of the highest window so far.
+    Value *highWater;
+    // Lox calls nest on the native stack, which may be used this many bytes
+    // deeper than where the runtime was created.
+    char *nativeBase;
+    size_t nativeLimit;
+    std::vector<Value> globals;
+    std::vector<char> defined;
+    const char *const *globalNames;
+
+    AotRuntime();
+
+    void init(int numGlobals, const char *const *names);
+    void defineNative(int slot, const char *name, int arity, AotNativeFn function);
+    void markRoots(Heap &heap) override;
+};
+
+extern AotRuntime runtime;
+
+[[noreturn]] void runtimeError(int line, const std::string &where, const std::string &message);
+[[noreturn]] void arityError(int line, int arity, int argCount);
+[[noreturn]] void undefinedProperty(int line, ObjString *name);
+
+Value callValue(Value *base, int argCount, int line);
+Value getProperty(Value object, ObjString *name, AotCache &cache, int line);
+void setProperty(Value object, ObjString *name, Value value, AotCache &cache);
+Value lookUpMethod(Value *base, ObjString *name, AotCache &cache, int line);
+Value getSuper(Value superclass, Value receiver, ObjString *name, int line);
+AotClass *newClass(const char *name, Value superclass, const char *superName, int line);
+void defineMethod(AotClass *klass, ObjString *name, AotFunction *method);
+void print(Value value);
+
+inline Value getGlobal(int slot, int line) {
+    if (!runtime.defined[slot]) {
+        runtimeError(line, runtime.globalNames[slot], "Undefined variable '" + std::string(runtime.globalNames[slot]) + "'");
+    }
+    return runtime.globals[slot];
+}
+
+inline void setGlobal(int slot, Value value, int line) {
+    if (!runtime.defined[slot]) {
+        runtimeError(line, runtime.globalNames[slot], "Undefined variable '" + std::string(runtime.globalNames[slot]) + "'");
+    }
+    runtime.globals[slot] = value;
+}
+
+inline void defineGlobal(int slot, Value value) {
+    runtime.globals[slot] = value;
+    runtime.defined[slot] = true;
+}
+
+// Runs a function in the window starting at frame, whose first argCount slots hold the arguments.
+inline Value callFunction(AotFunction *function, Value *frame, int argCount, int line) {
+    const AotProto *proto = function->proto;
+    if (proto->arity != argCount) {
+        arityError(line, proto->arity, argCount);
+    }
+    Value *end = frame + proto->frameSize;
+    if (end > runtime.stackEnd || size_t(runtime.nativeBase - static_cast<char*>(__builtin_frame_address(0))) > runtime.nativeLimit) {
+        runtimeError(line, "(", "Stack overflow.");
+    }
+    if (end > runtime.highWater) {
+        runtime.highWater = end;
+    }
+    heap().safepoint();
+    return proto->code(function, frame);
+}
+
+inline Value call(Value *base, int argCount, int line) {
+    if (base->isObjType(ObjType::AOT_FUNCTION)) {
+        return callFunction(base->asObj<AotFunction>(), base + 1, argCount, line);
+    }
+    return callValue(base, argCount, line);
+}
+
+// Clears the window of a returning function.
+inline Value leave(Value *frame, int frameSize, Value result) {
+    std::fill_n(frame, frameSize, Value());
+    return result;
+}
+
+inline void requireInstance(Value object, ObjString *name, int line) {
+    if (!object.isObjType(ObjType::AOT_INSTANCE)) {
+        runtimeError(line, name->chars, "Only instances have properties.");
+    }
+}
+
+inline Value negate(Value v, int line) {
+    if (!v.isNumber()) {
+        runtimeError(line, "-", "Operand must be number.");
+    }
+    return -v.asNumber();
+}
+
+inline Value add(Value lhs, Value rhs, int line) {
+    if (lhs.isNumber() && rhs.isNumber()) {
+        return lhs.asNumber() + rhs.asNumber();
+    } else if (lhs.isString() && rhs.isString()) {
+        return concatenate(lhs.asString(), rhs.asString());
+    }
+    runtimeError(line, "+", "Operands must be two numbers or two strings.");
+}
+
+inline void checkNumbers(Value lhs, Value rhs, const char *op, int line) {
+    if (!lhs.isNumber() || !rhs.isNumber()) {
+        runtimeError(line, op, "Operands must be numbers.");
+    }
+}
+
+inline Value subtract(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, "-", line);
+    return lhs.asNumber() - rhs.asNumber();
+}
+
+inline Value multiply(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, "*", line);
+    return lhs.asNumber() * rhs.asNumber();
+}
+
+inline Value divide(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, "/", line);
+    if (rhs.asNumber() == 0.0) {
+        runtimeError(line, "/", "Division by zero.");
+    }
+    return lhs.asNumber() / rhs.asNumber();
+}
+
+inline bool less(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, "<", line);
+    return lhs.asNumber() < rhs.asNumber();
+}
+
+inline bool lessEqual(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, "<=", line);
+    return lhs.asNumber() <= rhs.asNumber();
+}
+
+inline bool greater(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, ">", line);
+    return lhs.asNumber() > rhs.asNumber();
+}
+
+inline bool greaterEqual(Value lhs, Value rhs, int line) {
+    checkNumbers(lhs, rhs, ">=", line);
+    return lhs.asNumber() >= rhs.asNumber();
+}
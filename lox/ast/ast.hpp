@@ -1,6 +1,39 @@
 #pragma once
 #include <bits/stdc++.h>
 #include "../lexer/token.hpp"
+#include "../runtime/inline_cache.hpp"
+
+// Shape of the environment created for a block or a function call, computed by the resolver.
+struct FrameLayout {
+    // Number of names declared directly in the scope.
+    int numLocals = 0;
+    // Whether a closure can outlive the frame, which then has to live on the heap.
+    bool captured = false;
+};
+
+// Where the resolver found a local: the number of environments to walk up
+// and the index of the value in that environment. Depth -1 means not a local.
+struct LocalSlot {
+    int depth = -1;
+    int slot = 0;
+
+    bool isLocal() const {
+        return depth >= 0;
+    }
+};
+
+// Function body prepared once by the closure compiler.
+struct CompiledBody;
+// Native code for a function, owned by the JIT.
+struct JitEntry;
+
+// Operand types a binary operator has seen so far, which it specializes itself to at runtime.
+enum class Specialization {
+    UNINITIALIZED,
+    NUMBER,
+    STRING,
+    GENERIC
+};
 
 struct BinaryExpr;
 struct LogicalExpr;
@@ -39,6 +72,8 @@ struct BinaryExpr : public std::enable_shared_from_this<BinaryExpr>, Expr {
     std::shared_ptr<Expr> lhs;
     Token op;
     std::shared_ptr<Expr> rhs;
+    bool numeric = false;
+    Specialization specialization = Specialization::UNINITIALIZED;
 
     BinaryExpr(std::shared_ptr<Expr> lhs, Token op, std::shared_ptr<Expr> rhs) : lhs(lhs), op(op), rhs(rhs) {}
 
@@ -62,6 +97,7 @@ struct LogicalExpr : public std::enable_shared_from_this<LogicalExpr>, Expr {
 struct UnaryExpr : public std::enable_shared_from_this<UnaryExpr>, Expr {
     Token op;
     std::shared_ptr<Expr> expr;
+    bool numeric = false;
 
     UnaryExpr(Token op, std::shared_ptr<Expr> expr) : op(op), expr(expr) {}
 
@@ -71,9 +107,9 @@ struct UnaryExpr : public std::enable_shared_from_this<UnaryExpr>, Expr {
 };
 
 struct LiteralExpr : public std::enable_shared_from_this<LiteralExpr>, Expr {
-    std::any value;
+    Value value;
 
-    LiteralExpr(std::any value) : value(value) {}
+    LiteralExpr(Value value) : value(value) {}
 
     virtual void accept(VisitorExpr &visitor) override {
         visitor.visitLiteralExpr(shared_from_this());
@@ -92,6 +128,8 @@ struct GroupingExpr : public std::enable_shared_from_this<GroupingExpr>, Expr {
 
 struct VariableExpr : public std::enable_shared_from_this<VariableExpr>, Expr {
     Token name;
+    LocalSlot local;
+    int global = -1;
 
     VariableExpr(Token name) : name(name) {}
 
@@ -103,6 +141,8 @@ struct VariableExpr : public std::enable_shared_from_this<VariableExpr>, Expr {
 struct AssignmentExpr : public std::enable_shared_from_this<AssignmentExpr>, Expr {
     Token name;
     std::shared_ptr<Expr> expr;
+    LocalSlot local;
+    int global = -1;
 
     AssignmentExpr(Token name, std::shared_ptr<Expr> expr) : name(name), expr(expr) {}
 
@@ -115,6 +155,7 @@ struct CallExpr : public std::enable_shared_from_this<CallExpr>, Expr {
     std::shared_ptr<Expr> callee;
     Token paren;
     std::vector<std::shared_ptr<Expr>> arguments;
+    GetExpr *getCallee = nullptr;
 
     CallExpr(std::shared_ptr<Expr> callee, Token paren, std::vector<std::shared_ptr<Expr>> arguments) : callee(callee), paren(paren), arguments(arguments) {}
 
@@ -126,6 +167,7 @@ struct CallExpr : public std::enable_shared_from_this<CallExpr>, Expr {
 struct GetExpr : public std::enable_shared_from_this<GetExpr>, Expr {
     std::shared_ptr<Expr> object;
     Token name;
+    InlineCache cache;
 
     GetExpr(std::shared_ptr<Expr> object, Token name) : object(object), name(name) {}
 
@@ -138,6 +180,7 @@ struct SetExpr : public std::enable_shared_from_this<SetExpr>, Expr {
     std::shared_ptr<Expr> object;
     Token name;
     std::shared_ptr<Expr> value;
+    InlineCache cache;
 
     SetExpr(std::shared_ptr<Expr> object, Token name, std::shared_ptr<Expr> value) : object(object), name(name), value(value) {}
 
@@ -148,6 +191,7 @@ struct SetExpr : public std::enable_shared_from_this<SetExpr>, Expr {
 
 struct ThisExpr : public std::enable_shared_from_this<ThisExpr>, Expr {
     Token keyword;
+    LocalSlot local;
 
     ThisExpr(Token keyword) : keyword(keyword) {}
 
@@ -159,6 +203,7 @@ struct ThisExpr : public std::enable_shared_from_this<ThisExpr>, Expr {
 struct SuperExpr : public std::enable_shared_from_this<SuperExpr>, Expr {
     Token keyword;
     Token method;
+    LocalSlot local;
 
     SuperExpr(Token keyword, Token method) : keyword(keyword), method(method) {}
 
@@ -173,6 +218,7 @@ struct VarStmt;
 struct BlockStmt;
 struct IfStmt;
 struct WhileStmt;
+struct ForStmt;
 struct FunctionStmt;
 struct ClassStmt;
 struct ReturnStmt;
@@ -187,6 +233,7 @@ struct VisitorStmt {
     virtual void visitBlockStmt(std::shared_ptr<BlockStmt>) = 0;
     virtual void visitIfStmt(std::shared_ptr<IfStmt>) = 0;
     virtual void visitWhileStmt(std::shared_ptr<WhileStmt>) = 0;
+    virtual void visitForStmt(std::shared_ptr<ForStmt>) = 0;
     virtual void visitFunctionStmt(std::shared_ptr<FunctionStmt>) = 0;
     virtual void visitClassStmt(std::shared_ptr<ClassStmt>) = 0;
     virtual void visitReturnStmt(std::shared_ptr<ReturnStmt>) = 0;
@@ -231,6 +278,7 @@ struct VarStmt : public std::enable_shared_from_this<VarStmt>, Stmt {
 
 struct BlockStmt : public std::enable_shared_from_this<BlockStmt>, Stmt {
     std::vector<std::shared_ptr<Stmt>> statements;
+    FrameLayout frame;
 
     BlockStmt(std::vector<std::shared_ptr<Stmt>> statements) : statements(statements) {}
 
@@ -254,19 +302,37 @@ struct IfStmt : public std::enable_shared_from_this<IfStmt>, Stmt {
 struct WhileStmt : public std::enable_shared_from_this<WhileStmt>, Stmt {
     std::shared_ptr<Expr> cond;
     std::shared_ptr<Stmt> body;
-    bool isDesugaredFor;
 
-    WhileStmt(std::shared_ptr<Expr> cond, std::shared_ptr<Stmt> body, bool isDesugaredFor) : cond(cond), body(body), isDesugaredFor(isDesugaredFor) {}
+    WhileStmt(std::shared_ptr<Expr> cond, std::shared_ptr<Stmt> body) : cond(cond), body(body) {}
 
     virtual void accept(VisitorStmt &visitor) override {
         visitor.visitWhileStmt(shared_from_this());
     };
 };
 
+struct ForStmt : public std::enable_shared_from_this<ForStmt>, Stmt {
+    std::shared_ptr<Stmt> initializer;
+    std::shared_ptr<Expr> cond;
+    std::shared_ptr<Expr> increment;
+    std::shared_ptr<Stmt> body;
+    FrameLayout frame;
+    bool counted = false;
+    bool counterRead = false;
+
+    ForStmt(std::shared_ptr<Stmt> initializer, std::shared_ptr<Expr> cond, std::shared_ptr<Expr> increment, std::shared_ptr<Stmt> body) : initializer(initializer), cond(cond), increment(increment), body(body) {}
+
+    virtual void accept(VisitorStmt &visitor) override {
+        visitor.visitForStmt(shared_from_this());
+    };
+};
+
 struct FunctionStmt : public std::enable_shared_from_this<FunctionStmt>, Stmt {
     Token name;
     std::vector<Token> parameters;
     std::vector<std::shared_ptr<Stmt>> body;
+    FrameLayout frame;
+    std::shared_ptr<CompiledBody> compiled;
+    std::shared_ptr<JitEntry> native;
 
     FunctionStmt(Token name, std::vector<Token> parameters, std::vector<std::shared_ptr<Stmt>> body) : name(name), parameters(parameters), body(body) {}
 
@@ -290,6 +356,7 @@ struct ClassStmt : public std::enable_shared_from_this<ClassStmt>, Stmt {
 struct ReturnStmt : public std::enable_shared_from_this<ReturnStmt>, Stmt {
     Token keyword;
     std::shared_ptr<Expr> expr;
+    bool tailCall = false;
 
     ReturnStmt(Token keyword, std::shared_ptr<Expr> expr) : keyword(keyword), expr(expr) {}
 
@@ -37,13 +37,13 @@ void AstPrinter::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
 };
 
 void AstPrinter::visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) {
-    auto value = std::any_cast<double>(expr->value);
+    auto value = expr->value.asNumber();
     if (int(value) == value) {
         Return(std::to_string(int(value)));
     } else {
         Return(std::to_string(value));
     }
-    // Return(std::to_string(std::any_cast<double>(expr->value)));
+    // Return(std::to_string(expr->value.asNumber()));
 };
 
 void AstPrinter::visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) {
@@ -12,22 +12,3 @@ struct RunTimeError {
     RunTimeError(Token token, std::string message) : token(token), message(message) {}
 };
 
-struct ReturnValue {
-    Token keyword;
-    std::any value;
-
-    ReturnValue(Token keyword, std::any value) : keyword(keyword), value(value) {}
-};
-
-struct BreakLoop {
-    Token keyword;
-
-    BreakLoop(Token keyword) : keyword(keyword) {}
-};
-
-struct ContinueLoop {
-    Token keyword;
-
-    ContinueLoop(Token keyword) : keyword(keyword) {}
-};
-
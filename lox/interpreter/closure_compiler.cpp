@@ -0,0 +1,620 @@
+#include "closure_compiler.hpp"
+#include "objects.hpp"
+
+static void checkNumberOperands(const Token &op, Value lhs, Value rhs) {
+    if (!lhs.isNumber() || !rhs.isNumber()) {
+        throw RunTimeError(op, "Operands must be numbers.");
+    }
+}
+
+static void checkArity(const Token &paren, int arity, int argCount) {
+    if (arity != argCount) {
+        throw RunTimeError(paren, "Expected " + std::to_string(arity) + " parameters, but got " + std::to_string(argCount) + "arguments.");
+    }
+}
+
+void ClosureInterpreter::interpret(std::vector<std::shared_ptr<Stmt>> statements) {
+    ClosureCompiler compiler(*this);
+    std::vector<StmtCode> code = compiler.compile(statements);
+
+    try {
+        for (auto &statement : code) {
+            heap().safepoint();
+            completion = statement();
+            if (completion != Completion::NORMAL) {
+                break;
+            }
+        }
+    } catch (RunTimeError &e) {
+        stack.clear();
+        errorHandler.error(e);
+    }
+    finishTopLevel();
+}
+
+Completion ClosureInterpreter::runBlock(const std::vector<StmtCode> &statements, Environment *newEnvironment) {
+    EnvironmentScope scope(*this, newEnvironment);
+    for (auto &statement : statements) {
+        heap().safepoint();
+        if (Completion completion = statement(); completion != Completion::NORMAL) {
+            return completion;
+        }
+    }
+    return Completion::NORMAL;
+}
+
+// The arguments are read before anything else runs, so they may point into the value stack.
+Value ClosureInterpreter::callFunction(LoxFunction *function, Value *arguments, int argCount, LoxInstance *receiver) {
+    if (Value result; jit && !function->isMethod && jit->tryCall(function, arguments, argCount, result)) {
+        return result;
+    }
+    FunctionStmt *declaration = function->declaration.get();
+    auto environment = Environment::create(function->closure, declaration->frame);
+    if (function->isMethod) {
+        environment->define(receiver);
+    }
+    for (int i = 0; i < argCount; i++) {
+        environment->define(arguments[i]);
+    }
+    completion = runBlock(declaration->compiled->statements, environment);
+    return completeCall();
+}
+
+Value ClosureInterpreter::callValue(Value callee, Value *arguments, int argCount, const Token &paren) {
+    if (callee.isObj()) {
+        switch (callee.asObj()->type) {
+            case ObjType::FUNCTION: {
+                auto function = callee.asObj<LoxFunction>();
+                checkArity(paren, function->arity, argCount);
+                return callFunction(function, arguments, argCount, nullptr);
+            }
+            case ObjType::BOUND_METHOD: {
+                auto bound = callee.asObj<LoxBoundMethod>();
+                checkArity(paren, bound->arity, argCount);
+                return callFunction(bound->method, arguments, argCount, bound->receiver);
+            }
+            case ObjType::CLASS: {
+                // The instance is reachable from the initializer's frame while it runs.
+                auto klass = callee.asObj<LoxClass>();
+                checkArity(paren, klass->arity, argCount);
+                auto instance = LoxInstance::create(klass);
+                if (klass->initializer) {
+                    callFunction(klass->initializer, arguments, argCount, instance);
+                }
+                return instance;
+            }
+            case ObjType::NATIVE: {
+                auto native = callee.asObj<LoxNative>();
+                checkArity(paren, native->arity, argCount);
+                return native->function(argCount, arguments);
+            }
+            default:
+                break;
+        }
+    }
+    throw RunTimeError(paren, "Can only call functions and classes.");
+}
+
+ExprCode ClosureCompiler::compile(std::shared_ptr<Expr> expr) {
+    expr->accept(*this);
+    return std::move(exprCode);
+}
+
+ExprCode ClosureCompiler::compile(std::shared_ptr<Expr> expr, bool &mayCall) {
+    bool outer = calls;
+    calls = false;
+    ExprCode code = compile(expr);
+    mayCall = calls;
+    calls = outer || calls;
+    return code;
+}
+
+StmtCode ClosureCompiler::compile(std::shared_ptr<Stmt> stmt) {
+    stmt->accept(*this);
+    return std::move(stmtCode);
+}
+
+std::vector<StmtCode> ClosureCompiler::compile(const std::vector<std::shared_ptr<Stmt>> &statements) {
+    std::vector<StmtCode> code;
+    for (auto &statement : statements) {
+        code.push_back(compile(statement));
+    }
+    return code;
+}
+
+// A body is compiled once, however many closures are created from it.
+void ClosureCompiler::compileBody(std::shared_ptr<FunctionStmt> stmt) {
+    if (stmt->compiled) {
+        return;
+    }
+    stmt->compiled = std::make_shared<CompiledBody>();
+    depth++;
+    stmt->compiled->statements = compile(stmt->body);
+    depth--;
+}
+
+StmtCode ClosureCompiler::define(const Token &name, ExprCode value) {
+    auto in = &interpreter;
+    if (depth == 0) {
+        ObjString *identifier = name.identifier();
+        return [in, identifier, value] {
+            in->globals.define(identifier, value());
+            return Completion::NORMAL;
+        };
+    }
+    return [in, value] {
+        in->environment->define(value());
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) {
+    Value value = expr->value;
+    exprCode = [value] { return value; };
+}
+
+void ClosureCompiler::visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) {
+    exprCode = compile(expr->expr);
+}
+
+// Evaluates both operands and applies op. The left operand has to be on the
+// value stack only if evaluating the right one can collect garbage.
+template <typename Op>
+static ExprCode binary(ClosureInterpreter *in, ExprCode lhs, ExprCode rhs, bool rhsCalls, Op op) {
+    if (!rhsCalls) {
+        return [lhs, rhs, op] {
+            Value l = lhs();
+            return op(l, rhs());
+        };
+    }
+    return [in, lhs, rhs, op] {
+        in->stack.push_back(lhs());
+        Value r = rhs();
+        Value l = in->pop();
+        return op(l, r);
+    };
+}
+
+void ClosureCompiler::visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) {
+    auto in = &interpreter;
+    ExprCode lhs = compile(expr->lhs);
+    bool rhsCalls;
+    ExprCode rhs = compile(expr->rhs, rhsCalls);
+    const Token *op = &expr->op;
+
+    if (expr->numeric) {
+        // The type inference proved both operands are numbers.
+        switch (expr->op.type) {
+            case TokenType::GREATER:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() > r.asNumber()); });
+                return;
+            case TokenType::GREATER_EQUAL:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() >= r.asNumber()); });
+                return;
+            case TokenType::LESS:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() < r.asNumber()); });
+                return;
+            case TokenType::LESS_EQUAL:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() <= r.asNumber()); });
+                return;
+            case TokenType::PLUS:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() + r.asNumber()); });
+                return;
+            case TokenType::MINUS:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() - r.asNumber()); });
+                return;
+            case TokenType::STAR:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(l.asNumber() * r.asNumber()); });
+                return;
+            case TokenType::SLASH:
+                exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                    if (r.asNumber() == 0.0) {
+                        throw RunTimeError(*op, "Division by zero.");
+                    }
+                    return Value(l.asNumber() / r.asNumber());
+                });
+                return;
+            default:
+                break;
+        }
+    }
+
+    switch (expr->op.type) {
+        case TokenType::BANG_EQUAL:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(!isEqual(l, r)); });
+            break;
+        case TokenType::EQUAL_EQUAL:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [](Value l, Value r) { return Value(isEqual(l, r)); });
+            break;
+        case TokenType::GREATER:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                return Value(l.asNumber() > r.asNumber());
+            });
+            break;
+        case TokenType::GREATER_EQUAL:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                return Value(l.asNumber() >= r.asNumber());
+            });
+            break;
+        case TokenType::LESS:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                return Value(l.asNumber() < r.asNumber());
+            });
+            break;
+        case TokenType::LESS_EQUAL:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                return Value(l.asNumber() <= r.asNumber());
+            });
+            break;
+        case TokenType::PLUS:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                if (l.isNumber() && r.isNumber()) {
+                    return Value(l.asNumber() + r.asNumber());
+                } else if (l.isString() && r.isString()) {
+                    return Value(concatenate(l.asString(), r.asString()));
+                }
+                throw RunTimeError(*op, "Operands must be two numbers or two strings.");
+            });
+            break;
+        case TokenType::MINUS:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                return Value(l.asNumber() - r.asNumber());
+            });
+            break;
+        case TokenType::STAR:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                return Value(l.asNumber() * r.asNumber());
+            });
+            break;
+        case TokenType::SLASH:
+            exprCode = binary(in, lhs, rhs, rhsCalls, [op](Value l, Value r) {
+                checkNumberOperands(*op, l, r);
+                if (r.asNumber() == 0.0) {
+                    throw RunTimeError(*op, "Division by zero.");
+                }
+                return Value(l.asNumber() / r.asNumber());
+            });
+            break;
+        default:
+            std::cerr << "Closure compiler internal error: unknown binary operator\n";
+            exit(1);
+    }
+}
+
+void ClosureCompiler::visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) {
+    ExprCode lhs = compile(expr->lhs);
+    ExprCode rhs = compile(expr->rhs);
+    if (expr->op.type == TokenType::OR) {
+        exprCode = [lhs, rhs] {
+            Value l = lhs();
+            return isTruthy(l) ? l : rhs();
+        };
+    } else {
+        exprCode = [lhs, rhs] {
+            Value l = lhs();
+            return !isTruthy(l) ? l : rhs();
+        };
+    }
+}
+
+void ClosureCompiler::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
+    ExprCode operand = compile(expr->expr);
+    const Token *op = &expr->op;
+    if (expr->op.type == TokenType::MINUS && expr->numeric) {
+        exprCode = [operand] { return Value(-operand().asNumber()); };
+    } else if (expr->op.type == TokenType::MINUS) {
+        exprCode = [operand, op] {
+            Value v = operand();
+            if (!v.isNumber()) {
+                throw RunTimeError(*op, "Operand must be number.");
+            }
+            return Value(-v.asNumber());
+        };
+    } else {
+        exprCode = [operand] { return Value(!isTruthy(operand())); };
+    }
+}
+
+// Reads of locals in the current and the enclosing frame, by far the most
+// common, skip the walk up the environment chain.
+static ExprCode lookUp(ClosureInterpreter *in, LocalSlot local, const Token *name, int global) {
+    int slot = local.slot;
+    if (local.depth == 0) {
+        return [in, slot] { return in->environment->values[slot]; };
+    } else if (local.depth == 1) {
+        return [in, slot] { return in->environment->enclosing->values[slot]; };
+    } else if (local.isLocal()) {
+        return [in, local] { return in->environment->getAt(local); };
+    } else if (global >= 0) {
+        return [in, global, name] { return in->globals.get(global, *name); };
+    }
+    return [in, local, name, global] { return in->lookUpVariable(local, *name, global); };
+}
+
+void ClosureCompiler::visitVariableExpr(std::shared_ptr<VariableExpr> expr) {
+    exprCode = lookUp(&interpreter, expr->local, &expr->name, expr->global);
+}
+
+void ClosureCompiler::visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) {
+    auto in = &interpreter;
+    ExprCode value = compile(expr->expr);
+    LocalSlot local = expr->local;
+    if (local.depth == 0) {
+        int slot = local.slot;
+        exprCode = [in, value, slot] { return in->environment->values[slot] = value(); };
+    } else if (local.isLocal()) {
+        exprCode = [in, value, local] {
+            Value v = value();
+            in->environment->updateAt(local, v);
+            return v;
+        };
+    } else {
+        int global = expr->global;
+        const Token *name = &expr->name;
+        exprCode = [in, value, global, name] {
+            Value v = value();
+            in->globals.update(global, *name, v);
+            return v;
+        };
+    }
+}
+
+// The callee and the arguments stay on the value stack during the call.
+// A method call leaves the receiver in the callee's place and calls the
+// method without binding it.
+void ClosureCompiler::visitCallExpr(std::shared_ptr<CallExpr> expr) {
+    auto in = &interpreter;
+    const Token *paren = &expr->paren;
+    std::shared_ptr<GetExpr> get = std::dynamic_pointer_cast<GetExpr>(expr->callee);
+    ExprCode callee = compile(get ? get->object : expr->callee);
+    std::vector<ExprCode> arguments;
+    for (auto &argument : expr->arguments) {
+        arguments.push_back(compile(argument));
+    }
+    calls = true;
+
+    if (get) {
+        GetExpr *property = get.get();
+        exprCode = [in, callee, arguments, property, paren] {
+            size_t base = in->stack.size();
+            in->stack.push_back(callee());
+            LoxFunction *method = in->getProperty(property, in->stack.back(), true);
+            for (auto &argument : arguments) {
+                in->stack.push_back(argument());
+            }
+            Value *args = in->stack.data() + base + 1;
+            in->checkStack(*paren);
+            Value result;
+            if (method) {
+                checkArity(*paren, method->arity, arguments.size());
+                result = in->callFunction(method, args, arguments.size(), in->stack[base].asObj<LoxInstance>());
+            } else {
+                result = in->callValue(in->stack[base], args, arguments.size(), *paren);
+            }
+            in->stack.resize(base);
+            return result;
+        };
+    } else {
+        exprCode = [in, callee, arguments, paren] {
+            size_t base = in->stack.size();
+            in->stack.push_back(callee());
+            for (auto &argument : arguments) {
+                in->stack.push_back(argument());
+            }
+            in->checkStack(*paren);
+            Value result = in->callValue(in->stack[base], in->stack.data() + base + 1, arguments.size(), *paren);
+            in->stack.resize(base);
+            return result;
+        };
+    }
+}
+
+void ClosureCompiler::visitGetExpr(std::shared_ptr<GetExpr> expr) {
+    auto in = &interpreter;
+    ExprCode object = compile(expr->object);
+    GetExpr *property = expr.get();
+    exprCode = [in, object, property] {
+        Value v = object();
+        in->getProperty(property, v, false);
+        return v;
+    };
+}
+
+void ClosureCompiler::visitSetExpr(std::shared_ptr<SetExpr> expr) {
+    auto in = &interpreter;
+    ExprCode object = compile(expr->object);
+    bool valueCalls;
+    ExprCode value = compile(expr->value, valueCalls);
+    SetExpr *property = expr.get();
+    exprCode = [in, object, value, valueCalls, property] {
+        Value o = object();
+        if (!o.isInstance()) {
+            throw RunTimeError(property->name, "Only instances have properties.");
+        }
+        Value v;
+        if (valueCalls) {
+            in->stack.push_back(o);
+            v = value();
+            o = in->pop();
+        } else {
+            v = value();
+        }
+        in->setProperty(property, o.asObj<LoxInstance>(), v);
+        return v;
+    };
+}
+
+void ClosureCompiler::visitThisExpr(std::shared_ptr<ThisExpr> expr) {
+    exprCode = lookUp(&interpreter, expr->local, &expr->keyword, -1);
+}
+
+void ClosureCompiler::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {
+    auto in = &interpreter;
+    SuperExpr *super = expr.get();
+    exprCode = [in, super] { return in->lookUpSuper(super); };
+}
+
+void ClosureCompiler::visitBreakStmt(std::shared_ptr<BreakStmt> stmt) {
+    auto in = &interpreter;
+    const Token *keyword = &stmt->keyword;
+    stmtCode = [in, keyword] {
+        in->completionKeyword = keyword;
+        return Completion::BREAK;
+    };
+}
+
+void ClosureCompiler::visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) {
+    auto in = &interpreter;
+    const Token *keyword = &stmt->keyword;
+    stmtCode = [in, keyword] {
+        in->completionKeyword = keyword;
+        return Completion::CONTINUE;
+    };
+}
+
+void ClosureCompiler::visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) {
+    ExprCode expr = compile(stmt->expr);
+    stmtCode = [expr] {
+        expr();
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitPrintStmt(std::shared_ptr<PrintStmt> stmt) {
+    ExprCode expr = compile(stmt->expr);
+    stmtCode = [expr] {
+        std::cout << stringify(expr()) << "\n";
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitVarStmt(std::shared_ptr<VarStmt> stmt) {
+    ExprCode initializer = (stmt->initializer ? compile(stmt->initializer) : [] { return Value(); });
+    stmtCode = define(stmt->name, initializer);
+}
+
+void ClosureCompiler::visitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+    auto in = &interpreter;
+    depth++;
+    std::vector<StmtCode> statements = compile(stmt->statements);
+    depth--;
+    FrameLayout frame = stmt->frame;
+    stmtCode = [in, statements, frame] {
+        return in->runBlock(statements, Environment::create(in->environment, frame));
+    };
+}
+
+void ClosureCompiler::visitIfStmt(std::shared_ptr<IfStmt> stmt) {
+    ExprCode guard = compile(stmt->guard);
+    StmtCode then = compile(stmt->then);
+    StmtCode elsee = (stmt->elsee ? compile(stmt->elsee) : [] { return Completion::NORMAL; });
+    stmtCode = [guard, then, elsee] {
+        return isTruthy(guard()) ? then() : elsee();
+    };
+}
+
+void ClosureCompiler::visitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+    ExprCode cond = compile(stmt->cond);
+    StmtCode body = compile(stmt->body);
+
+    stmtCode = [cond, body] {
+        while (isTruthy(cond())) {
+            heap().safepoint();
+            Completion completion = body();
+            if (completion == Completion::BREAK) {
+                break;
+            } else if (completion == Completion::RETURN) {
+                return completion;
+            }
+        }
+        return Completion::NORMAL;
+    };
+}
+
+// The loop variable lives in one environment for the whole loop, and a
+// continue only skips the rest of the body.
+void ClosureCompiler::visitForStmt(std::shared_ptr<ForStmt> stmt) {
+    auto in = &interpreter;
+    depth++;
+    StmtCode initializer = stmt->initializer ? compile(stmt->initializer) : nullptr;
+    ExprCode cond = stmt->cond ? compile(stmt->cond) : nullptr;
+    StmtCode body = compile(stmt->body);
+    ExprCode increment = stmt->increment ? compile(stmt->increment) : nullptr;
+    depth--;
+    FrameLayout frame = stmt->frame;
+
+    stmtCode = [in, initializer, cond, body, increment, frame] {
+        EnvironmentScope scope(*in, Environment::create(in->environment, frame));
+        if (initializer) {
+            initializer();
+        }
+        while (!cond || isTruthy(cond())) {
+            heap().safepoint();
+            Completion completion = body();
+            if (completion == Completion::BREAK) {
+                break;
+            } else if (completion == Completion::RETURN) {
+                return completion;
+            }
+            if (increment) {
+                increment();
+            }
+        }
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+    auto in = &interpreter;
+    compileBody(stmt);
+    stmtCode = define(stmt->name, [in, stmt] { return Value(heap().allocate<LoxFunction>(stmt, in->environment)); });
+}
+
+void ClosureCompiler::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+    auto in = &interpreter;
+    ExprCode superclassCode = (stmt->superclass ? compile(stmt->superclass) : nullptr);
+    for (auto &method : stmt->methods) {
+        compileBody(method);
+    }
+    ClassStmt *klass = stmt.get();
+
+    stmtCode = define(stmt->name, [in, superclassCode, klass] {
+        LoxClass *superclass = nullptr;
+        if (superclassCode) {
+            Value super = superclassCode();
+            if (!super.isClass()) {
+                throw RunTimeError(klass->superclass->name, "Superclass must be a class.");
+            }
+            superclass = super.asObj<LoxClass>();
+            in->environment = Environment::createOnHeap(in->environment, 1);
+            in->environment->define(superclass);
+        }
+
+        std::unordered_map<ObjString*, LoxFunction*, ObjStringHash> methods;
+        for (auto &method : klass->methods) {
+            methods[method->name.identifier()] = heap().allocate<LoxFunction>(method, in->environment, true);
+        }
+
+        if (superclass) {
+            in->environment = in->environment->enclosing;
+        }
+        return Value(heap().allocate<LoxClass>(klass->name.lexeme, superclass, methods));
+    });
+}
+
+void ClosureCompiler::visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+    auto in = &interpreter;
+    ExprCode value = (stmt->expr ? compile(stmt->expr) : [] { return Value(); });
+    const Token *keyword = &stmt->keyword;
+    stmtCode = [in, value, keyword] {
+        in->returnValue = value();
+        in->completionKeyword = keyword;
+        return Completion::RETURN;
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "interpreter.hpp"
+
+typedef std::function<Value()> ExprCode;
+typedef std::function<Completion()> StmtCode;
+
+struct CompiledBody {
+    std::vector<StmtCode> statements;
+};
+
+// Runs a program converted once into C++ closures: every node becomes a
+// callable with its operands, operators and resolved slots already bound,
+// so running it needs no visitor dispatch. It shares environments, objects
+// and inline caches with the tree-walker. Temporaries stay in C++ locals
+// and go on the value stack only while a call, and so a safepoint, can run.
+struct ClosureInterpreter : Interpreter {
+    ClosureInterpreter(ErrorHandler &errorHandler) : Interpreter(errorHandler) {}
+
+    void interpret(std::vector<std::shared_ptr<Stmt>> statements);
+
+    Completion runBlock(const std::vector<StmtCode> &statements, Environment *newEnvironment);
+    Value callValue(Value callee, Value *arguments, int argCount, const Token &paren);
+    Value callFunction(LoxFunction *function, Value *arguments, int argCount, LoxInstance *receiver);
+};
+
+struct ClosureCompiler : VisitorExpr, VisitorStmt {
+    ClosureInterpreter &interpreter;
+    // Result of the last visit.
+    ExprCode exprCode;
+    StmtCode stmtCode;
+    // Whether the expressions compiled so far contain a call.
+    bool calls;
+    // Nesting of blocks and functions; 0 at the top level, where variables are globals.
+    int depth;
+
+    ClosureCompiler(ClosureInterpreter &interpreter) : interpreter(interpreter), calls(false), depth(0) {}
+
+    ExprCode compile(std::shared_ptr<Expr> expr);
+    ExprCode compile(std::shared_ptr<Expr> expr, bool &mayCall);
+    StmtCode compile(std::shared_ptr<Stmt> stmt);
+    std::vector<StmtCode> compile(const std::vector<std::shared_ptr<Stmt>> &statements);
+    void compileBody(std::shared_ptr<FunctionStmt> stmt);
+    StmtCode define(const Token &name, ExprCode value);
+
+    void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override;
+    void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override;
+    void visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) override;
+    void visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) override;
+    void visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) override;
+    void visitVariableExpr(std::shared_ptr<VariableExpr> expr) override;
+    void visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) override;
+    void visitCallExpr(std::shared_ptr<CallExpr> expr) override;
+    void visitGetExpr(std::shared_ptr<GetExpr> expr) override;
+    void visitSetExpr(std::shared_ptr<SetExpr> expr) override;
+    void visitThisExpr(std::shared_ptr<ThisExpr> expr) override;
+    void visitSuperExpr(std::shared_ptr<SuperExpr> expr) override;
+
+    void visitBreakStmt(std::shared_ptr<BreakStmt> expr) override;
+    void visitContinueStmt(std::shared_ptr<ContinueStmt> expr) override;
+    void visitExpressionStmt(std::shared_ptr<ExpressionStmt> expr) override;
+    void visitPrintStmt(std::shared_ptr<PrintStmt> expr) override;
+    void visitVarStmt(std::shared_ptr<VarStmt> expr) override;
+    void visitBlockStmt(std::shared_ptr<BlockStmt>) override;
+    void visitIfStmt(std::shared_ptr<IfStmt>) override;
+    void visitWhileStmt(std::shared_ptr<WhileStmt>) override;
+    void visitForStmt(std::shared_ptr<ForStmt>) override;
+    void visitFunctionStmt(std::shared_ptr<FunctionStmt>) override;
+    void visitClassStmt(std::shared_ptr<ClassStmt>) override;
+    void visitReturnStmt(std::shared_ptr<ReturnStmt>) override;
+};
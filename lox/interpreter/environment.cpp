@@ -1,51 +1,40 @@
 #include "environment.hpp"
 #include "../error/exceptions.hpp"
 
-Environment::Environment() : enclosing(nullptr) {}
-Environment::Environment(std::shared_ptr<Environment> enclosing) : enclosing(enclosing) {}
-
-Environment *Environment::ancestor(int numHops) {
-    Environment *env = this;
-    while (numHops--) {
-        env = (env->enclosing).get();
-    }
-    return env;
+Environment::Environment(Environment *enclosing, int capacity, bool inArena)
+    : Obj(ObjType::ENVIRONMENT), enclosing(enclosing), inArena(inArena), count(0), capacity(capacity) {
+    values = reinterpret_cast<Value*>(this + 1);
 }
 
-void Environment::define(std::string name, std::any value) {
-    bindings[name] = value;
-}
-
-std::any Environment::get(Token name) {
-    if (bindings.count(name.lexeme)) {
-        return bindings[name.lexeme];
+Environment *Environment::create(Environment *enclosing, const FrameLayout &layout) {
+    if (layout.captured) {
+        return createOnHeap(enclosing, layout.numLocals);
     }
+    size_t bytes = sizeof(Environment) + layout.numLocals * sizeof(Value);
+    return heap().arena.allocate<Environment>(bytes, enclosing, layout.numLocals, true);
+}
 
-    throw RunTimeError(name, "Undefined variable '" + name.lexeme + "'");
+Environment *Environment::createOnHeap(Environment *enclosing, int capacity) {
+    size_t bytes = sizeof(Environment) + capacity * sizeof(Value);
+    return heap().allocateSized<Environment>(bytes, enclosing, capacity, false);
 }
 
-std::any Environment::getAt(int numHops, Token name) {
-    return ancestor(numHops)->get(name);
+void Environment::show() {
+    std::cout << "Environment: " << count << " locals\n";
 }
 
-void Environment::update(Token name, std::any value) {
-    if (bindings.count(name.lexeme)) {
-        bindings[name.lexeme] = value;
-        return;
-    }
 
-    throw RunTimeError(name, "Undefined variable '" + name.lexeme + "'");
+std::string Environment::toString() {
+    return "<environment>";
 }
 
-void Environment::updateAt(int numHops, Token name, std::any value) {
-    ancestor(numHops)->update(name, value);
+size_t Environment::size() const {
+    return sizeof(Environment) + capacity * sizeof(Value);
 }
 
-void Environment::show() {
-    std::cout << "Environment: ";
-    for (auto [k, v] : bindings) {
-        std::cout << k << " ";
+void Environment::trace(Heap &heap) {
+    for (int i = 0; i < count; i++) {
+        heap.markValue(values[i]);
     }
-    std::cout << "\n";
+    heap.markObject(enclosing);
 }
-
@@ -3,19 +3,54 @@
 #include <bits/stdc++.h>
 
 #include "../lexer/token.hpp"
+#include "../ast/ast.hpp"
+#include "../runtime/heap.hpp"
 
-struct Environment {
-    std::map<std::string, std::any> bindings;
-    std::shared_ptr<Environment> enclosing;
+// Locals are stored inline after the object, in declaration order, so the
+// slots assigned by the resolver index them directly. Frames that no
+// closure can capture live in the heap's frame arena instead of being
+// collected.
+struct Environment : Obj {
+    Environment *enclosing;
+    bool inArena;
+    int count;
+    int capacity;
+    Value *values;
 
-    Environment();
-    Environment(std::shared_ptr<Environment> enclosing);
+    Environment(Environment *enclosing, int capacity, bool inArena);
+
+    static Environment *create(Environment *enclosing, const FrameLayout &layout);
+    static Environment *createOnHeap(Environment *enclosing, int capacity);
+    // Memory for the inline values comes from the same allocation.
+    static void operator delete(void *memory) {
+        ::operator delete(memory);
+    }
+
+    Environment *ancestor(int numHops) {
+        Environment *env = this;
+        while (numHops--) {
+            env = env->enclosing;
+        }
+        return env;
+    }
+
+    // Locals are defined in the order the resolver assigned their slots.
+    void define(Value value) {
+        assert(count < capacity);
+        values[count++] = value;
+    }
+
+    Value getAt(LocalSlot local) {
+        return ancestor(local.depth)->values[local.slot];
+    }
+
+    void updateAt(LocalSlot local, Value value) {
+        ancestor(local.depth)->values[local.slot] = value;
+    }
 
-    Environment *ancestor(int numHops);
-    void define(std::string name, std::any value);
-    void update(Token name, std::any value);
-    void updateAt(int numHops, Token name, std::any value);
     void show();
-    std::any get(Token name);
-    std::any getAt(int numHops, Token name);
+
+    std::string toString() override;
+    size_t size() const override;
+    void trace(Heap &heap) override;
 };
@@ -0,0 +1,31 @@
+#include "globals.hpp"
+#include "../error/exceptions.hpp"
+
+int GlobalTable::slot(ObjString *name) {
+    if (auto it = indices.find(name); it != indices.end()) {
+        return it->second;
+    }
+    int index = names.size();
+    indices[name] = index;
+    names.push_back(name);
+    values.push_back(nullptr);
+    defined.push_back(false);
+    return index;
+}
+
+void GlobalTable::define(ObjString *name, Value value) {
+    int index = slot(name);
+    values[index] = value;
+    defined[index] = true;
+}
+
+void GlobalTable::trace(Heap &heap) {
+    for (int i = 0; i < int(names.size()); i++) {
+        heap.markObject(names[i]);
+        heap.markValue(values[i]);
+    }
+}
+
+void GlobalTable::undefined(const Token &name) {
+    throw RunTimeError(name, "Undefined variable '" + name.lexeme + "'");
+}
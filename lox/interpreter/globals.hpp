@@ -0,0 +1,40 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "../lexer/token.hpp"
+#include "../runtime/heap.hpp"
+
+// Global variables, stored densely by index. A name gets its index the first
+// time the resolver sees it, at a definition or at a use, and the node caches
+// it. A use resolved before the definition has run (a function referring to
+// a later one, or a name defined on a later REPL line) finds the slot
+// undefined until then.
+struct GlobalTable {
+    std::unordered_map<ObjString*, int, ObjStringHash> indices;
+    std::vector<ObjString*> names;
+    std::vector<Value> values;
+    std::vector<bool> defined;
+
+    int slot(ObjString *name);
+    void define(ObjString *name, Value value);
+
+    Value get(int slot, const Token &name) {
+        if (!defined[slot]) {
+            undefined(name);
+        }
+        return values[slot];
+    }
+
+    void update(int slot, const Token &name, Value value) {
+        if (!defined[slot]) {
+            undefined(name);
+        }
+        values[slot] = value;
+    }
+
+    void trace(Heap &heap);
+
+private:
+    [[noreturn]] void undefined(const Token &name);
+};
@@ -1,98 +1,125 @@
 #include "interpreter.hpp"
 #include "objects.hpp"
 
-Interpreter::Interpreter(ErrorHandler &errorHandler) : errorHandler(errorHandler) {
-    globals = std::make_shared<Environment>(nullptr);
-    environment = globals;
+#include <sys/resource.h>
 
-    struct NativeClock : LoxCallable {
-        std::any call(Interpreter &interpreter, std::vector<std::any> arguments) override {
-            return double(time(0));
-        }
-        int arity() override {
-            return 0;
-        }
-        std::string toString() override {
-            return "<native clock fn>";
-        }
-    };
-    std::shared_ptr<LoxCallable> clock(std::make_shared<NativeClock>());
-    globals->define("clock", clock);
+static Value clockNative(int argCount, Value *args) {
+    return double(time(0));
+}
+
+Interpreter::Interpreter(ErrorHandler &errorHandler) : errorHandler(errorHandler), completion(Completion::NORMAL), completionKeyword(nullptr), tailFunction(nullptr), tailReceiver(nullptr), tailCalls(true), jit(nullptr) {
+    // What is left of the native stack, less room for natives and native code.
+    rlimit limit;
+    getrlimit(RLIMIT_STACK, &limit);
+    stackBase = static_cast<char*>(__builtin_frame_address(0));
+    stackLimit = (limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : limit.rlim_cur - std::min<size_t>(limit.rlim_cur / 2, 1 << 20));
+
+    globalEnvironment = Environment::createOnHeap(nullptr, 0);
+    environment = globalEnvironment;
+    heap().addRoots(this);
+
+    defineNative("clock", 0, clockNative);
+}
+
+Interpreter::~Interpreter() {
+    heap().removeRoots(this);
+}
+
+void Interpreter::defineNative(std::string name, int arity, LoxNativeFn function) {
+    globals.define(heap().pin(intern(name)), heap().allocate<LoxNative>(name, arity, function));
+}
 
+void Interpreter::markRoots(Heap &heap) {
+    globals.trace(heap);
+    heap.markObject(globalEnvironment);
+    heap.markValue(returnValue);
+    heap.markObject(tailFunction);
+    heap.markObject(tailReceiver);
+    for (auto &value : tailArguments) {
+        heap.markValue(value);
+    }
+    heap.markObject(environment);
+    for (auto env : environments) {
+        heap.markObject(env);
+    }
+    for (auto &value : stack) {
+        heap.markValue(value);
+    }
 }
 
 void Interpreter::interpret(std::vector<std::shared_ptr<Stmt>> statements) {
     try {
         for (auto statement : statements) {
             execute(statement);
+            if (completion != Completion::NORMAL) {
+                break;
+            }
         }
     } catch (RunTimeError &e) {
+        stack.clear();
         errorHandler.error(e);
-    } catch (ReturnValue &v) {
-        errorHandler.error(v.keyword, "Return statement at the top level.");
-    } catch (BreakLoop &b) {
-        errorHandler.error(b.keyword, "Break statement at the top level.");
-    } catch (ContinueLoop &c) {
-        errorHandler.error(c.keyword, "Continue statement at the top level.");
-    } 
+    }
+    finishTopLevel();
 }
 
-std::any Interpreter::evaluate(std::shared_ptr<Expr> e) {
+// Reports a return, break or continue that left the top level.
+void Interpreter::finishTopLevel() {
+    switch (completion) {
+        case Completion::RETURN:
+            errorHandler.error(*completionKeyword, "Return statement at the top level.");
+            break;
+        case Completion::BREAK:
+            errorHandler.error(*completionKeyword, "Break statement at the top level.");
+            break;
+        case Completion::CONTINUE:
+            errorHandler.error(*completionKeyword, "Continue statement at the top level.");
+            break;
+        default:
+            break;
+    }
+    completion = Completion::NORMAL;
+    returnValue = nullptr;
+}
+
+Value Interpreter::evaluate(std::shared_ptr<Expr> e) {
     e->accept(*this);
-    assert(stack.size() > 0);
-    auto res = stack.back();
-    stack.pop_back();
-    return res;
+    return pop();
 }
 
 void Interpreter::execute(std::shared_ptr<Stmt> s) {
+    // Statement boundaries are the only points where the collector may run:
+    // every value still in use is then either in an environment or on the stack.
+    heap().safepoint();
     s->accept(*this);
 }
 
-void Interpreter::Return(std::any v) {
+void Interpreter::Return(Value v) {
     stack.push_back(v);
 }
 
-std::string Interpreter::stringify(std::any v) {
-    if (v.type() == typeid(double)) {
-        auto d = std::any_cast<double>(v);
-        if (int(d) == d) {
-            return std::to_string(int(d));
-        } else {
-            return std::to_string(d);
-        }
-    } else if (v.type() == typeid(bool)) {
-        return std::any_cast<bool>(v) == true ? "true" : "false";
-    } else if (v.type() == typeid(std::string)) {
-        return std::any_cast<std::string>(v);
-    } else if (v.type() == typeid(std::nullptr_t)) {
-        return "nil";
-    } else if (v.type() == typeid(std::shared_ptr<LoxCallable>)) {
-        return std::any_cast<std::shared_ptr<LoxCallable>>(v)->toString();
-    } else if (v.type() == typeid(std::shared_ptr<LoxInstance>)) {
-        return std::any_cast<std::shared_ptr<LoxInstance>>(v)->toString();
-    } else if (v.type() == typeid(std::shared_ptr<LoxClass>)) {
-        return std::any_cast<std::shared_ptr<LoxClass>>(v)->toString();
-    }
-    assert(0);
-}
-
-void Interpreter::checkNumberOperand(Token op, std::any v) {
-    if (v.type() == typeid(double)) {
+Value Interpreter::pop() {
+    assert(stack.size() > 0);
+    auto res = stack.back();
+    stack.pop_back();
+    return res;
+}
+
+void Interpreter::checkNumberOperand(const Token &op, Value v) {
+    if (v.isNumber()) {
         return;
     }
     throw RunTimeError(op, "Operand must be number.");
 }
 
-void Interpreter::checkNumberOperands(Token op, std::any lhs, std::any rhs) {
-    if (lhs.type() == typeid(double) && rhs.type() == typeid(double)) {
+void Interpreter::checkNumberOperands(const Token &op, Value lhs, Value rhs) {
+    if (lhs.isNumber() && rhs.isNumber()) {
         return;
     }
     throw RunTimeError(op, "Operands must be numbers.");
 }
 
-void Interpreter::checkBooleanOperands(Token op, std::any lhs, std::any rhs) {
-    if (lhs.type() == typeid(bool) && rhs.type() == typeid(bool)) {
+void Interpreter::checkBooleanOperands(const Token &op, Value lhs, Value rhs) {
+    if (lhs.isBool() && rhs.isBool()) {
         return;
     }
     throw RunTimeError(op, "Operands must be booleans.");
@@ -106,9 +133,92 @@ void Interpreter::visitGroupingExpr(std::shared_ptr<GroupingExpr> e) {
     Return(evaluate(e->expr));
 }
 
+// Operators whose operands were proven numbers, by the type inference or by
+// a guard, skip the checks.
+static Value numericBinary(const Token &op, double lhs, double rhs) {
+    switch (op.type) {
+        case TokenType::GREATER:       return lhs > rhs;
+        case TokenType::GREATER_EQUAL: return lhs >= rhs;
+        case TokenType::LESS:          return lhs < rhs;
+        case TokenType::LESS_EQUAL:    return lhs <= rhs;
+        case TokenType::PLUS:          return lhs + rhs;
+        case TokenType::MINUS:         return lhs - rhs;
+        case TokenType::STAR:          return lhs * rhs;
+        case TokenType::SLASH:
+            if (rhs == 0.0) {
+                throw RunTimeError(op, "Division by zero.");
+            }
+            return lhs / rhs;
+        default:
+            std::cerr << "Interpreter internal error: unknown numeric operator\n";
+            exit(1);
+    }
+}
+
+static bool isNumericOperator(TokenType type) {
+    switch (type) {
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+        case TokenType::PLUS:
+        case TokenType::MINUS:
+        case TokenType::STAR:
+        case TokenType::SLASH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Runs an operator the way it specialized itself to the operands seen on
+// its first evaluation, behind a guard on their types. A failed guard
+// rewrites it to the generic operator for good. False means the generic
+// path has to run.
+static bool runSpecialized(BinaryExpr &e, Value lhs, Value rhs, Value &result) {
+    switch (e.specialization) {
+        case Specialization::UNINITIALIZED:
+            if (lhs.isNumber() && rhs.isNumber() && isNumericOperator(e.op.type)) {
+                e.specialization = Specialization::NUMBER;
+            } else if (lhs.isString() && rhs.isString() && e.op.type == TokenType::PLUS) {
+                e.specialization = Specialization::STRING;
+            } else {
+                e.specialization = Specialization::GENERIC;
+                return false;
+            }
+            return runSpecialized(e, lhs, rhs, result);
+        case Specialization::NUMBER:
+            if (lhs.isNumber() && rhs.isNumber()) {
+                result = numericBinary(e.op, lhs.asNumber(), rhs.asNumber());
+                return true;
+            }
+            break;
+        case Specialization::STRING:
+            if (lhs.isString() && rhs.isString()) {
+                result = concatenate(lhs.asString(), rhs.asString());
+                return true;
+            }
+            break;
+        case Specialization::GENERIC:
+            return false;
+    }
+    e.specialization = Specialization::GENERIC;
+    return false;
+}
+
 void Interpreter::visitBinaryExpr(std::shared_ptr<BinaryExpr> e) {
-    auto lhs = evaluate(e->lhs);
+    e->lhs->accept(*this); // stays on the stack while rhs is evaluated
     auto rhs = evaluate(e->rhs);
+    auto lhs = pop();
+
+    if (e->numeric) {
+        Return(numericBinary(e->op, lhs.asNumber(), rhs.asNumber()));
+        return;
+    }
+    if (Value result; runSpecialized(*e, lhs, rhs, result)) {
+        Return(result);
+        return;
+    }
 
     switch (e->op.type) {
         case TokenType::BANG_EQUAL:
@@ -120,45 +230,45 @@ void Interpreter::visitBinaryExpr(std::shared_ptr<BinaryExpr> e) {
 
         case TokenType::GREATER:
             checkNumberOperands(e->op, lhs, rhs);
-            Return(std::any_cast<double>(lhs) > std::any_cast<double>(rhs));
+            Return(lhs.asNumber() > rhs.asNumber());
             break;
         case TokenType::GREATER_EQUAL:
             checkNumberOperands(e->op, lhs, rhs);
-            Return(std::any_cast<double>(lhs) >= std::any_cast<double>(rhs));
+            Return(lhs.asNumber() >= rhs.asNumber());
             break;
         case TokenType::LESS:
             checkNumberOperands(e->op, lhs, rhs);
-            Return(std::any_cast<double>(lhs) < std::any_cast<double>(rhs));
+            Return(lhs.asNumber() < rhs.asNumber());
             break;
         case TokenType::LESS_EQUAL:
             checkNumberOperands(e->op, lhs, rhs);
-            Return(std::any_cast<double>(lhs) <= std::any_cast<double>(rhs));
+            Return(lhs.asNumber() <= rhs.asNumber());
             break;
 
         case TokenType::PLUS:
-            if (lhs.type() == typeid(double) && rhs.type() == typeid(double)) {
-                Return(std::any_cast<double>(lhs) + std::any_cast<double>(rhs));
-            } else if (lhs.type() == typeid(std::string) && rhs.type() == typeid(std::string)) {
-                Return(std::any_cast<std::string>(lhs) + std::any_cast<std::string>(rhs));
+            if (lhs.isNumber() && rhs.isNumber()) {
+                Return(lhs.asNumber() + rhs.asNumber());
+            } else if (lhs.isString() && rhs.isString()) {
+                Return(concatenate(lhs.asString(), rhs.asString()));
             } else {
                 throw RunTimeError(e->op, "Operands must be two numbers or two strings.");
             }
             break;
         case TokenType::MINUS:
             checkNumberOperands(e->op, lhs, rhs);
-            Return(std::any_cast<double>(lhs) - std::any_cast<double>(rhs));
+            Return(lhs.asNumber() - rhs.asNumber());
             break;
 
         case TokenType::STAR:
             checkNumberOperands(e->op, lhs, rhs);
-            Return(std::any_cast<double>(lhs) * std::any_cast<double>(rhs));
+            Return(lhs.asNumber() * rhs.asNumber());
             break;
         case TokenType::SLASH:
             checkNumberOperands(e->op, lhs, rhs);
-            if (std::any_cast<double>(rhs) == 0.0) {
+            if (rhs.asNumber() == 0.0) {
                 throw RunTimeError(e->op, "Division by zero.");
             }
-            Return(std::any_cast<double>(lhs) / std::any_cast<double>(rhs));
+            Return(lhs.asNumber() / rhs.asNumber());
             break;
 
         default:
@@ -191,8 +301,10 @@ void Interpreter::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
 
     switch (expr->op.type) {
         case TokenType::MINUS:
-            checkNumberOperand(expr->op, v);
-            Return(-std::any_cast<double>(v)); 
+            if (!expr->numeric) {
+                checkNumberOperand(expr->op, v);
+            }
+            Return(-v.asNumber()); 
             break;
         case TokenType::BANG:
             Return(!isTruthy(v));
@@ -202,92 +314,216 @@ void Interpreter::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
     }
 }
 
-std::any Interpreter::lookUpVariable(std::shared_ptr<Expr> expr, Token name) {
-    if (locals.count(expr)) {
-        return environment->getAt(locals[expr], name);
+Value Interpreter::lookUpVariable(LocalSlot local, const Token &name, int global) {
+    if (local.isLocal()) {
+        return environment->getAt(local);
+    } else if (global >= 0) {
+        return globals.get(global, name);
     } else {
-        return globals->get(name);
+        throw RunTimeError(name, "Undefined variable '" + name.lexeme + "'");
     }
 }
 
 void Interpreter::visitVariableExpr(std::shared_ptr<VariableExpr> expr) {
-    Return(lookUpVariable(expr, expr->name));
+    Return(lookUpVariable(expr->local, expr->name, expr->global));
 }
 
 void Interpreter::visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) {
-    std::any v = evaluate(expr->expr);
-    if (locals.count(expr)) {
-        environment->updateAt(locals[expr], expr->name, v);
+    Value v = evaluate(expr->expr);
+    if (expr->local.isLocal()) {
+        environment->updateAt(expr->local, v);
     } else {
-        globals->update(expr->name, v);
+        globals.update(expr->global, expr->name, v);
     }
     Return(v);
 }
 
 void Interpreter::visitCallExpr(std::shared_ptr<CallExpr> expr) {
-    std::any callee = evaluate(expr->callee);
+    // The callee and the arguments stay on the stack until the call returns.
+    size_t base = stack.size();
+    LoxFunction *method = nullptr;
+    LoxCallable *callable = evaluateCall(expr.get(), method);
+    Value *arguments = stack.data() + base + 1;
+    int argCount = stack.size() - base - 1;
+    Value result = (method ? method->invoke(*this, arguments, argCount, stack[base].asObj<LoxInstance>()) : call(callable, arguments, argCount));
+    stack.resize(base);
+    Return(result);
+}
+
+// Calls what evaluateCall returned, by its type.
+Value Interpreter::call(LoxCallable *callable, Value *arguments, int argCount) {
+    switch (callable->type) {
+        case ObjType::FUNCTION:
+            return static_cast<LoxFunction*>(callable)->invoke(*this, arguments, argCount, nullptr);
+        case ObjType::BOUND_METHOD: {
+            auto bound = static_cast<LoxBoundMethod*>(callable);
+            return bound->method->invoke(*this, arguments, argCount, bound->receiver);
+        }
+        case ObjType::CLASS:
+            return static_cast<LoxClass*>(callable)->instantiate(*this, arguments, argCount);
+        default:
+            return static_cast<LoxNative*>(callable)->function(argCount, arguments);
+    }
+}
 
-    std::vector<std::any> arguments;
+// Pushes the callee and the arguments of a call, and returns what to call
+// once it is known to take that many arguments. For a method call the
+// receiver takes the place of the callee and the method is also set.
+LoxCallable *Interpreter::evaluateCall(CallExpr *expr, LoxFunction *&method) {
+    size_t base = stack.size();
+    if (auto get = expr->getCallee; get) {
+        get->object->accept(*this);
+        method = getProperty(get, stack.back(), true);
+    } else {
+        expr->callee->accept(*this);
+    }
     for (auto argument : expr->arguments) {
-        arguments.push_back(evaluate(argument));
+        argument->accept(*this);
     }
 
-    if (callee.type() == typeid(std::shared_ptr<LoxClass>)) { // consequence of not having Object class and using std::any
-        callee = std::static_pointer_cast<LoxCallable>(std::any_cast<std::shared_ptr<LoxClass>>(callee));
+    Value callee = stack[base];
+    if (!method && !callee.isCallable()) {
+        throw RunTimeError(expr->paren, "Can only call functions and classes.");
     }
+    auto callable = (method ? method : callee.asObj<LoxCallable>());
+    int argCount = stack.size() - base - 1;
+    if (callable->arity != argCount) {
+        throw RunTimeError(expr->paren, "Expected " + std::to_string(callable->arity) + " parameters, but got " + std::to_string(argCount) + "arguments.");
+    }
+    checkStack(expr->paren);
+    return callable;
+}
 
-    if (callee.type() == typeid(std::shared_ptr<LoxCallable>)) {
-        auto callable = std::any_cast<std::shared_ptr<LoxCallable>>(callee);
-        if (callable->arity() == arguments.size()) {
-            try {
-                Return(callable->call(*this, arguments));
-            } catch (ReturnValue &returnvalue) {
-                Return(returnvalue.value);
-            } catch (BreakLoop &b) {
-                throw RunTimeError(b.keyword, "Break statement at the function level.");
-            } catch (ContinueLoop &b) {
-                throw RunTimeError(b.keyword, "Continue statement at the function level.");
-            } 
-        } else {
-            throw RunTimeError(expr->paren, "Expected " + std::to_string(callable->arity()) + " parameters, but got " + std::to_string(arguments.size()) + "arguments.");
-        }
-    } else {
-        throw RunTimeError(expr->paren, "Can only call functions and classes.");
+// Reports a call nested too deeply instead of letting it crash the process.
+// Native code from the JIT stops at the same limit and leaves the report here.
+void Interpreter::checkStack(const Token &paren) {
+    if (size_t(stackBase - static_cast<char*>(__builtin_frame_address(0))) > stackLimit) {
+        throw RunTimeError(paren, "Stack overflow.");
     }
 }
 
-void Interpreter::visitGetExpr(std::shared_ptr<GetExpr> expr) {
-    std::any object = evaluate(expr->object);
-    if (object.type() == typeid(std::shared_ptr<LoxInstance>)) {
-        Return(std::any_cast<std::shared_ptr<LoxInstance>>(object)->get(expr->name));
+// Leaves the function with a call to a Lox function still to be made, which
+// LoxFunction::invoke then makes in place of the returning frame. Natives
+// and classes are called right away.
+void Interpreter::tailCall(CallExpr *expr) {
+    size_t base = stack.size();
+    LoxFunction *method = nullptr;
+    LoxCallable *callable = evaluateCall(expr, method);
+    LoxInstance *receiver = nullptr;
+    if (method) {
+        receiver = stack[base].asObj<LoxInstance>();
+    } else if (callable->type == ObjType::FUNCTION) {
+        method = static_cast<LoxFunction*>(callable);
+    } else if (callable->type == ObjType::BOUND_METHOD) {
+        auto bound = static_cast<LoxBoundMethod*>(callable);
+        method = bound->method;
+        receiver = bound->receiver;
+    }
+
+    if (!method) {
+        returnValue = call(callable, stack.data() + base + 1, stack.size() - base - 1);
+        stack.resize(base);
+        completion = Completion::RETURN;
         return;
     }
+    tailFunction = method;
+    tailReceiver = receiver;
+    tailArguments.assign(stack.begin() + base + 1, stack.end());
+    stack.resize(base);
+    completion = Completion::TAIL_CALL;
+}
+
+void Interpreter::visitGetExpr(std::shared_ptr<GetExpr> expr) {
+    expr->object->accept(*this);
+    getProperty(expr.get(), stack.back(), false);
+}
+
+// Replaces the instance in object with the value of its property. When the
+// property is a method about to be invoked, the method is returned instead
+// and the instance is left in place as the receiver.
+LoxFunction *Interpreter::getProperty(GetExpr *expr, Value &object, bool invoke) {
+    if (!object.isInstance()) {
+        throw RunTimeError(expr->name, "Only instances have properties.");
+    }
+    auto instance = object.asObj<LoxInstance>();
+
+    int index;
+    LoxFunction *method;
+    if (auto entry = expr->cache.find(instance->shape, heap().stats.collections); entry) {
+        cacheStats.getHits++;
+        index = entry->index;
+        method = entry->method;
+    } else {
+        cacheStats.getMisses++;
+        // Fields shadow methods.
+        index = instance->shape->lookup(expr->name.identifier());
+        method = (index < 0 ? instance->klass->findMethod(expr->name.identifier()) : nullptr);
+        if (index < 0 && !method) {
+            throw RunTimeError(expr->name, "Undefined property '" + expr->name.lexeme + "'.");
+        }
+        expr->cache.add({instance->shape, index, method, nullptr});
+    }
 
-    throw RunTimeError(expr->name, "Only instances have properties.");
+    if (index >= 0) {
+        object = instance->fields[index];
+        return nullptr;
+    }
+    if (invoke) {
+        return method;
+    }
+    object = heap().allocate<LoxBoundMethod>(instance, method);
+    return nullptr;
 }
 
 void Interpreter::visitSetExpr(std::shared_ptr<SetExpr> expr) {
-    std::any object = evaluate(expr->object);
-    if (object.type() != typeid(std::shared_ptr<LoxInstance>)) {
+    expr->object->accept(*this); // stays on the stack while the value is evaluated
+    if (!stack.back().isInstance()) {
         throw RunTimeError(expr->name, "Only instances have properties.");
     }
 
-    std::any value = evaluate(expr->value);
-    std::any_cast<std::shared_ptr<LoxInstance>>(object)->update(expr->name, value);
+    Value value = evaluate(expr->value);
+    auto instance = pop().asObj<LoxInstance>();
     Return(value);
+    setProperty(expr.get(), instance, value);
+}
+
+void Interpreter::setProperty(SetExpr *expr, LoxInstance *instance, Value value) {
+    if (auto entry = expr->cache.find(instance->shape, heap().stats.collections); entry) {
+        cacheStats.setHits++;
+        if (entry->transition) {
+            instance->transitionTo(entry->transition);
+        }
+        instance->fields[entry->index] = value;
+        return;
+    }
+    cacheStats.setMisses++;
+
+    Shape *shape = instance->shape;
+    int index = shape->lookup(expr->name.identifier());
+    if (index >= 0) {
+        expr->cache.add({shape, index, nullptr, nullptr});
+    } else {
+        index = instance->addField(expr->name.identifier());
+        expr->cache.add({shape, index, nullptr, instance->shape});
+    }
+    instance->fields[index] = value;
 }
 
 void Interpreter::visitThisExpr(std::shared_ptr<ThisExpr> expr) {
-    Return(lookUpVariable(expr, expr->keyword));
+    Return(lookUpVariable(expr->local, expr->keyword, -1));
 }
 
 void Interpreter::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {
-    if (locals.count(expr)) {
-        std::shared_ptr<LoxClass> superclass = std::any_cast<std::shared_ptr<LoxClass>>(environment->getAt(locals[expr], expr->keyword));
-        std::shared_ptr<LoxInstance> object  = std::any_cast<std::shared_ptr<LoxInstance>>(environment->getAt(locals[expr] - 1, Token(TokenType::THIS, "this", 0, 0)));
-        if (std::shared_ptr<LoxFunction> method = superclass->findMethod(expr->method.lexeme); method) {
-            Return(std::static_pointer_cast<LoxCallable>(method->bind(object)));
-            return;
+    Return(lookUpSuper(expr.get()));
+}
+
+Value Interpreter::lookUpSuper(SuperExpr *expr) {
+    if (expr->local.isLocal()) {
+        // 'this' is bound in the environment just inside the one holding 'super'.
+        Value superclass = environment->getAt(expr->local);
+        Value object = environment->getAt({expr->local.depth - 1, 0});
+        if (LoxFunction *method = superclass.asObj<LoxClass>()->findMethod(expr->method.identifier()); method) {
+            return heap().allocate<LoxBoundMethod>(object.asObj<LoxInstance>(), method);
         } else {
             throw RunTimeError(expr->method, "Undefined property " + expr->method.lexeme + ".");
         }
@@ -296,32 +532,14 @@ void Interpreter::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {
     }
 }
 
-bool Interpreter::isEqual(std::any lhs, std::any rhs) {
-    if (lhs.type() != rhs.type()) return false;
-    if (lhs.type() == typeid(std::nullptr_t)) return true;
-
-    if (lhs.type() == typeid(double)) {
-        return std::any_cast<double>(lhs) == std::any_cast<double>(rhs);
-    } else if (lhs.type() == typeid(std::string)) {
-        return std::any_cast<std::string>(lhs) == std::any_cast<std::string>(rhs);
-    } else if (lhs.type() == typeid(bool)) {
-        return std::any_cast<bool>(lhs) == std::any_cast<bool>(rhs);
-    }
-    assert(0);
-}
-
-bool Interpreter::isTruthy(std::any v) {
-    if (v.type() == typeid(std::nullptr_t)) return false;
-    if (v.type() == typeid(bool)) return std::any_cast<bool>(v);
-    return true;
-}
-
 void Interpreter::visitBreakStmt(std::shared_ptr<BreakStmt> expr) {
-    throw BreakLoop(expr->keyword);
+    completion = Completion::BREAK;
+    completionKeyword = &expr->keyword;
 }
 
 void Interpreter::visitContinueStmt(std::shared_ptr<ContinueStmt> expr) {
-    throw ContinueLoop(expr->keyword);
+    completion = Completion::CONTINUE;
+    completionKeyword = &expr->keyword;
 }
 
 void Interpreter::visitExpressionStmt(std::shared_ptr<ExpressionStmt> s) {
@@ -334,36 +552,58 @@ void Interpreter::visitPrintStmt(std::shared_ptr<PrintStmt> s) {
 }
 
 void Interpreter::visitVarStmt(std::shared_ptr<VarStmt> expr) {
-    std::any value = nullptr;
+    Value value = nullptr;
     if (expr->initializer != nullptr) {
         value = evaluate(expr->initializer);
     }
-    environment->define(expr->name.lexeme, value);
+    define(expr->name, value);
 }
 
 void Interpreter::visitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
-    executeBlock(stmt->statements, std::make_shared<Environment>(environment));
+    executeBlock(stmt->statements, Environment::create(environment, stmt->frame));
 }
 
-void Interpreter::executeBlock(std::vector<std::shared_ptr<Stmt>> statements, std::shared_ptr<Environment> newEnvironment) {
-    auto previous = environment;
-    environment = newEnvironment;
-
-    struct RAII {
-        std::shared_ptr<Environment> &e;
-        std::shared_ptr<Environment> &p;
-        RAII(std::shared_ptr<Environment> &e, std::shared_ptr<Environment> &p) : e(e), p(p) {}
-        ~RAII() { e = p; }
-    } raii(environment, previous);
-
-    for (auto statement : statements) {
+void Interpreter::executeBlock(const std::vector<std::shared_ptr<Stmt>> &statements, Environment *newEnvironment) {
+    EnvironmentScope scope(*this, newEnvironment);
+    for (auto &statement : statements) {
         execute(statement);
+        if (completion != Completion::NORMAL) {
+            return;
+        }
     }
 }
 
-void Interpreter::resolve(std::shared_ptr<Expr> expr, int numHops) {
-    assert(!locals.count(expr));
-    locals[expr] = numHops;
+// Consumes the completion of a function body, giving the call's result.
+Value Interpreter::completeCall() {
+    switch (completion) {
+        case Completion::NORMAL:
+            return nullptr;
+        case Completion::RETURN: {
+            completion = Completion::NORMAL;
+            Value value = returnValue;
+            returnValue = nullptr;
+            return value;
+        }
+        case Completion::BREAK:
+            completion = Completion::NORMAL;
+            throw RunTimeError(*completionKeyword, "Break statement at the function level.");
+        case Completion::CONTINUE:
+            completion = Completion::NORMAL;
+            throw RunTimeError(*completionKeyword, "Continue statement at the function level.");
+        case Completion::TAIL_CALL:
+            // LoxFunction::invoke makes pending tail calls before completing the call.
+            assert(false);
+            break;
+    }
+    return nullptr;
+}
+
+void Interpreter::define(const Token &name, Value value) {
+    if (environment == globalEnvironment) {
+        globals.define(name.identifier(), value);
+    } else {
+        environment->define(value);
+    }
 }
 
 void Interpreter::visitIfStmt(std::shared_ptr<IfStmt> stmt) {
@@ -376,59 +616,116 @@ void Interpreter::visitIfStmt(std::shared_ptr<IfStmt> stmt) {
 
 void Interpreter::visitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
     while (isTruthy(evaluate(stmt->cond))) {
-        try {
-            execute(stmt->body);
-        } catch (BreakLoop &b) {
+        execute(stmt->body);
+        if (completion == Completion::BREAK) {
+            completion = Completion::NORMAL;
             break;
-        } catch (ContinueLoop &c) {
-            if (stmt->isDesugaredFor) {
-                std::shared_ptr<BlockStmt> body = std::dynamic_pointer_cast<BlockStmt>(stmt->body); 
-                assert(body != nullptr);
-                assert(body->statements.size() == 2);
-                // Wrap into block because of lexical name resolution.
-                execute(std::make_shared<BlockStmt>(std::vector<std::shared_ptr<Stmt>>{body->statements[1]}));
-            }
-            continue;
+        } else if (completion == Completion::CONTINUE) {
+            completion = Completion::NORMAL;
+        } else if (completion != Completion::NORMAL) {
+            return;
+        }
+    }
+}
+
+void Interpreter::visitForStmt(std::shared_ptr<ForStmt> stmt) {
+    EnvironmentScope scope(*this, Environment::create(environment, stmt->frame));
+    if (stmt->counted) {
+        runCountedLoop(*stmt);
+        return;
+    }
+    if (stmt->initializer != nullptr) {
+        execute(stmt->initializer);
+    }
+    while (stmt->cond == nullptr || isTruthy(evaluate(stmt->cond))) {
+        execute(stmt->body);
+        if (completion == Completion::BREAK) {
+            completion = Completion::NORMAL;
+            break;
+        } else if (completion == Completion::CONTINUE) {
+            completion = Completion::NORMAL;
+        } else if (completion != Completion::NORMAL) {
+            return;
+        }
+        if (stmt->increment != nullptr) {
+            evaluate(stmt->increment);
+        }
+    }
+}
+
+// Runs a loop the type inference found counted, with the counter in a
+// native double. It is only stored in its slot when something reads it.
+void Interpreter::runCountedLoop(ForStmt &stmt) {
+    auto initializer = std::static_pointer_cast<VarStmt>(stmt.initializer);
+    auto cond = std::static_pointer_cast<BinaryExpr>(stmt.cond);
+    auto sum = std::static_pointer_cast<BinaryExpr>(std::static_pointer_cast<AssignmentExpr>(stmt.increment)->expr);
+    double step = std::static_pointer_cast<LiteralExpr>(sum->rhs)->value.asNumber();
+
+    double counter = evaluate(initializer->initializer).asNumber();
+    environment->define(counter);
+    Value *slot = &environment->values[0];
+    for (;; counter += step) {
+        if (stmt.counterRead) {
+            *slot = counter;
+        }
+        Value limit = evaluate(cond->rhs);
+        if (!limit.isNumber()) {
+            throw RunTimeError(cond->op, "Operands must be numbers.");
+        }
+        if (cond->op.type == TokenType::LESS ? !(counter < limit.asNumber()) : !(counter <= limit.asNumber())) {
+            break;
+        }
+        execute(stmt.body);
+        if (completion == Completion::BREAK) {
+            completion = Completion::NORMAL;
+            break;
+        } else if (completion == Completion::CONTINUE) {
+            completion = Completion::NORMAL;
+        } else if (completion != Completion::NORMAL) {
+            return;
         }
     }
 }
 
 void Interpreter::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
-    std::shared_ptr<LoxCallable> loxFunction = std::make_shared<LoxFunction>(stmt, environment);
-    environment->define(stmt->name.lexeme, loxFunction);
+    define(stmt->name, heap().allocate<LoxFunction>(stmt, environment));
 }
 
 void Interpreter::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
-    std::shared_ptr<LoxClass> superclass = nullptr;
+    LoxClass *superclass = nullptr;
     if (stmt->superclass) {
-        std::any super = evaluate(stmt->superclass);
-        if (super.type() != typeid(std::shared_ptr<LoxClass>)) {
+        Value super = evaluate(stmt->superclass);
+        if (!super.isClass()) {
             throw RunTimeError(stmt->superclass->name, "Superclass must be a class.");
         }
-        superclass = std::any_cast<std::shared_ptr<LoxClass>>(super);
+        superclass = super.asObj<LoxClass>();
     }
 
     if (stmt->superclass) {
-        environment = std::make_shared<Environment>(environment);
-        environment->define("super", superclass);
+        environment = Environment::createOnHeap(environment, 1);
+        environment->define(superclass);
     }
 
-    std::map<std::string, std::shared_ptr<LoxFunction>> methods;
+    std::unordered_map<ObjString*, LoxFunction*, ObjStringHash> methods;
     for (auto method : stmt->methods) {
-        methods[method->name.lexeme] = std::make_shared<LoxFunction>(method, environment);
+        methods[method->name.identifier()] = heap().allocate<LoxFunction>(method, environment, true);
     }
 
     if (stmt->superclass) {
         environment = environment->enclosing;
     }
 
-    std::shared_ptr<LoxClass> klass = std::make_shared<LoxClass>(stmt->name.lexeme, superclass, methods);
-    environment->define(stmt->name.lexeme, klass);
+    define(stmt->name, heap().allocate<LoxClass>(stmt->name.lexeme, superclass, methods));
 }
 
 void Interpreter::visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
-    std::any value = (stmt->expr == nullptr ? nullptr : evaluate(stmt->expr));
-    throw ReturnValue(stmt->keyword, value);
+    completionKeyword = &stmt->keyword;
+    if (tailCalls && stmt->tailCall) {
+        tailCall(static_cast<CallExpr*>(stmt->expr.get()));
+        return;
+    }
+    returnValue = (stmt->expr == nullptr ? nullptr : evaluate(stmt->expr));
+    completion = Completion::RETURN;
 }
 
 
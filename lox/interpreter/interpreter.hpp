@@ -3,26 +3,71 @@
 #include <bits/stdc++.h>
 
 #include "environment.hpp"
+#include "globals.hpp"
 #include "../ast/ast.hpp"
 #include "../error/error_handler.hpp"
 
-struct Interpreter : VisitorExpr, VisitorStmt {
-    std::shared_ptr<Environment> globals;
-    std::shared_ptr<Environment> environment;
-    std::map<std::shared_ptr<Expr>, int> locals;
+// How the last executed statement finished. Anything but NORMAL makes the
+// enclosing blocks stop executing until a loop or a call consumes it.
+enum class Completion {
+    NORMAL,
+    RETURN,
+    // A return of a call still to be made, which the caller's frame makes instead.
+    TAIL_CALL,
+    BREAK,
+    CONTINUE
+};
+
+struct LoxInstance;
+struct LoxFunction;
+struct LoxCallable;
+struct Jit;
+
+typedef Value (*LoxNativeFn)(int argCount, Value *args);
+
+struct Interpreter : VisitorExpr, VisitorStmt, GcRoots {
+    GlobalTable globals;
+    // Empty environment enclosing everything defined at the top level.
+    Environment *globalEnvironment;
+    Environment *environment;
+    // Environments suspended by executeBlock, innermost last.
+    std::vector<Environment*> environments;
     ErrorHandler &errorHandler;
-    std::vector<std::any> stack;
+    std::vector<Value> stack;
+    InlineCacheStats cacheStats;
+    Completion completion;
+    // The keyword of the return, break or continue statement, and the returned value.
+    const Token *completionKeyword;
+    Value returnValue;
+    // The function, receiver and arguments of a pending tail call.
+    LoxFunction *tailFunction;
+    LoxInstance *tailReceiver;
+    std::vector<Value> tailArguments;
+    // Whether returned calls reuse the returning frame; off keeps every frame for debugging.
+    bool tailCalls;
+    // Runs hot numeric functions natively when set.
+    Jit *jit;
+    // Calls nest on the native stack, which may be used this many bytes
+    // deeper than where the engine was created.
+    char *stackBase;
+    size_t stackLimit;
 
     Interpreter(ErrorHandler &errorHandler);
+    ~Interpreter();
+
+    void markRoots(Heap &heap) override;
 
     void interpret(std::vector<std::shared_ptr<Stmt>> statements);
-    std::any evaluate(std::shared_ptr<Expr> expr);
+    Value evaluate(std::shared_ptr<Expr> expr);
     void execute(std::shared_ptr<Stmt> expr);
-    void executeBlock(std::vector<std::shared_ptr<Stmt>> statements, std::shared_ptr<Environment> newEnvironment);
-    void resolve(std::shared_ptr<Expr> expr, int numHops);
+    void executeBlock(const std::vector<std::shared_ptr<Stmt>> &statements, Environment *newEnvironment);
+    Value completeCall();
+    void finishTopLevel();
+    void define(const Token &name, Value value);
+    void defineNative(std::string name, int arity, LoxNativeFn function);
 
-    void Return(std::any v);
-    std::string stringify(std::any v);
+    void Return(Value v);
+    Value pop();
 
     void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override;
     void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override;
@@ -45,16 +90,43 @@ struct Interpreter : VisitorExpr, VisitorStmt {
     void visitBlockStmt(std::shared_ptr<BlockStmt>) override;
     void visitIfStmt(std::shared_ptr<IfStmt>) override;
     void visitWhileStmt(std::shared_ptr<WhileStmt>) override;
+    void visitForStmt(std::shared_ptr<ForStmt>) override;
+    void runCountedLoop(ForStmt &stmt);
     void visitFunctionStmt(std::shared_ptr<FunctionStmt>) override;
     void visitClassStmt(std::shared_ptr<ClassStmt>) override;
     void visitReturnStmt(std::shared_ptr<ReturnStmt>) override;
 
-    void checkNumberOperand(Token token, std::any v);
-    void checkNumberOperands(Token token, std::any lhs, std::any rhs);
-    void checkBooleanOperands(Token op, std::any lhs, std::any rhs);
+    LoxCallable *evaluateCall(CallExpr *expr, LoxFunction *&method);
+    Value call(LoxCallable *callable, Value *arguments, int argCount);
+    void tailCall(CallExpr *expr);
+    void checkStack(const Token &paren);
 
-    bool isEqual(std::any lhs, std::any rhs);
-    bool isTruthy(std::any v);
-    std::any lookUpVariable(std::shared_ptr<Expr> expr, Token name);
+    void checkNumberOperand(const Token &token, Value v);
+    void checkNumberOperands(const Token &token, Value lhs, Value rhs);
+    void checkBooleanOperands(const Token &op, Value lhs, Value rhs);
+
+    LoxFunction *getProperty(GetExpr *expr, Value &object, bool invoke);
+    void setProperty(SetExpr *expr, LoxInstance *instance, Value value);
+    Value lookUpVariable(LocalSlot local, const Token &name, int global);
+    Value lookUpSuper(SuperExpr *expr);
 };
 
+
+// Makes an environment current for the lifetime of the scope, also when an
+// error unwinds it, and releases it afterwards if it came from the arena.
+struct EnvironmentScope {
+    Interpreter &interpreter;
+
+    EnvironmentScope(Interpreter &interpreter, Environment *newEnvironment) : interpreter(interpreter) {
+        interpreter.environments.push_back(interpreter.environment);
+        interpreter.environment = newEnvironment;
+    }
+
+    ~EnvironmentScope() {
+        if (interpreter.environment->inArena) {
+            heap().arena.release(interpreter.environment);
+        }
+        interpreter.environment = interpreter.environments.back();
+        interpreter.environments.pop_back();
+    }
+};
@@ -1,103 +1,249 @@
 #include "interpreter.hpp"
+#include "../jit/jit.hpp"
+#include "../runtime/shape.hpp"
 
 struct LoxInstance;
 
-struct LoxCallable {
-    virtual std::any call(Interpreter &Interpreter, std::vector<std::any> arguments) = 0;
-    virtual int arity() = 0;
-    virtual std::string toString() = 0;
+// Anything a call can call. The engines dispatch on the object type, so a
+// call needs no virtual calls, and the arity is kept here to be checked
+// without knowing the kind of callable.
+struct LoxCallable : Obj {
+    int arity;
+
+    LoxCallable(ObjType type, int arity) : Obj(type), arity(arity) {}
 };
 
-struct LoxFunction : LoxCallable {
-    std::shared_ptr<FunctionStmt> declaration;
-    std::shared_ptr<Environment> closure;
+// Natives see their arguments where the caller evaluated them.
+struct LoxNative : LoxCallable {
+    std::string name;
+    LoxNativeFn function;
 
-    LoxFunction(std::shared_ptr<FunctionStmt> declration, std::shared_ptr<Environment> closure) : declaration(declration), closure(closure) {}
+    LoxNative(std::string name, int arity, LoxNativeFn function) : LoxCallable(ObjType::NATIVE, arity), name(name), function(function) {}
 
-    std::any call(Interpreter &interpreter, std::vector<std::any> arguments) {
-        auto environment = std::make_shared<Environment>(closure);
-        assert(declaration->parameters.size() == arguments.size());
-        for (int i = 0; i < arguments.size(); i++) {
-            environment->define(declaration->parameters[i].lexeme, arguments[i]);
-        }
-        interpreter.executeBlock(declaration->body, environment);
-        return nullptr;
+    std::string toString() override {
+        return "<native " + name + " fn>";
+    }
+
+    size_t size() const override {
+        return sizeof(LoxNative);
     }
+};
+
+struct LoxFunction : LoxCallable {
+    std::shared_ptr<FunctionStmt> declaration;
+    Environment *closure;
+    // Methods take the receiver in slot 0 of their frame.
+    bool isMethod;
 
-    int arity() {
-        return declaration->parameters.size();
+    LoxFunction(std::shared_ptr<FunctionStmt> declration, Environment *closure, bool isMethod = false) : LoxCallable(ObjType::FUNCTION, declration->parameters.size()), declaration(declration), closure(closure), isMethod(isMethod) {
+        assert(!closure->inArena);
     }
 
-    std::string toString() {
+    Value invoke(Interpreter &interpreter, Value *arguments, int argCount, LoxInstance *receiver);
+
+    std::string toString() override {
         return "<fn " + declaration->name.lexeme + ">";
     }
 
-    std::shared_ptr<LoxFunction> bind(std::shared_ptr<LoxInstance> instance) {
-        auto environment = std::make_shared<Environment>(closure);
-        environment->define("this", instance);
-        return std::make_shared<LoxFunction>(declaration, environment);
+    size_t size() const override {
+        return sizeof(LoxFunction);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(closure);
     }
 };
 
-struct LoxClass : LoxCallable, public std::enable_shared_from_this<LoxClass> {
+struct LoxClass : LoxCallable {
     std::string name;
-    std::shared_ptr<LoxClass> superclass;
-    std::map<std::string, std::shared_ptr<LoxFunction>> methods;
+    LoxClass *superclass;
+    // Own and inherited methods, so lookup never walks the superclass chain.
+    std::unordered_map<ObjString*, LoxFunction*, ObjStringHash> methods;
+    LoxFunction *initializer;
+    // Shape of a fresh instance, the root of the class's shape tree.
+    Shape *rootShape;
+    // Most fields any instance has had so far; new instances reserve this many inline.
+    int expectedFields;
+
+    LoxClass(std::string name, LoxClass *superclass, const std::unordered_map<ObjString*, LoxFunction*, ObjStringHash> &ownMethods) : LoxCallable(ObjType::CLASS, 0), name(name), superclass(superclass), expectedFields(0) {
+        if (superclass) {
+            methods = superclass->methods;
+        }
+        for (auto &[methodName, method] : ownMethods) {
+            methods[methodName] = method;
+        }
+        initializer = findMethod(names().init);
+        if (initializer) {
+            arity = initializer->arity;
+        }
+        rootShape = heap().allocate<Shape>(nullptr, nullptr);
+    }
 
-    LoxClass(std::string name, std::shared_ptr<LoxClass> superclass, std::map<std::string, std::shared_ptr<LoxFunction>> methods) : name(name), superclass(superclass), methods(methods) {}
+    Value instantiate(Interpreter &interpreter, Value *arguments, int argCount);
 
-    std::any call(Interpreter &interpreter, std::vector<std::any> arguments) override {
-        auto instance = std::make_shared<LoxInstance>(shared_from_this());
-        if (auto init = findMethod("init"); init) {
-            init->bind(instance)->call(interpreter, arguments);
+    std::string toString() override {
+        return "<class " + name + ">";
+    }
+
+    size_t size() const override {
+        return sizeof(LoxClass) + methods.size() * sizeof(std::pair<ObjString*, LoxFunction*>);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(superclass);
+        heap.markObject(rootShape);
+        for (auto &[name, method] : methods) {
+            heap.markObject(name);
+            heap.markObject(method);
         }
-        return instance;
     }
 
-    int arity() override {
-        if (auto init = findMethod("init"); init) {
-            return init->arity();
+    LoxFunction *findMethod(ObjString *name) {
+        auto it = methods.find(name);
+        return it != methods.end() ? it->second : nullptr;
+    }
+};
+
+// Field values are stored by the index their shape assigns, inline after the
+// object while they fit and in a separate array once the instance outgrows
+// the slots reserved for it.
+struct LoxInstance : Obj {
+    LoxClass *klass;
+    Shape *shape;
+    int capacity;
+    Value *fields;
+
+    LoxInstance(LoxClass *klass, int capacity) : Obj(ObjType::INSTANCE), klass(klass), shape(klass->rootShape), capacity(capacity) {
+        fields = inlineFields();
+    }
+
+    ~LoxInstance() override {
+        if (fields != inlineFields()) {
+            delete[] fields;
         }
-        return 0;
     }
 
-    std::string toString() override {
-        return "<class " + name + ">";
+    static LoxInstance *create(LoxClass *klass) {
+        int capacity = klass->expectedFields;
+        return heap().allocateSized<LoxInstance>(sizeof(LoxInstance) + capacity * sizeof(Value), klass, capacity);
+    }
+
+    // Memory for the inline fields comes from the same allocation.
+    static void operator delete(void *memory) {
+        ::operator delete(memory);
+    }
+
+    Value *inlineFields() {
+        return reinterpret_cast<Value*>(this + 1);
     }
 
-    std::shared_ptr<LoxFunction> findMethod(std::string name) {
-        if (methods.count(name)) {
-            return methods[name];
+    // Index of the new field.
+    int addField(ObjString *name) {
+        transitionTo(shape->transition(name));
+        return shape->numFields() - 1;
+    }
+
+    // Switches to a shape with one more field, making room for its value.
+    void transitionTo(Shape *next) {
+        shape = next;
+        int index = shape->numFields() - 1;
+        if (index == capacity) {
+            int newCapacity = std::max(4, 2 * capacity);
+            Value *newFields = new Value[newCapacity];
+            std::copy(fields, fields + capacity, newFields);
+            if (fields != inlineFields()) {
+                delete[] fields;
+            }
+            heap().bytesAllocated += (newCapacity - capacity) * sizeof(Value);
+            fields = newFields;
+            capacity = newCapacity;
         }
-        if (superclass) {
-            return superclass->findMethod(name);
+        klass->expectedFields = std::max(klass->expectedFields, shape->numFields());
+    }
+
+    std::string toString() override {
+        return "<" + klass->name + " object>";
+    }
+
+    size_t size() const override {
+        return sizeof(LoxInstance) + capacity * sizeof(Value);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(klass);
+        heap.markObject(shape);
+        for (int i = 0; i < shape->numFields(); i++) {
+            heap.markValue(fields[i]);
         }
-        return nullptr;
     }
 };
 
-struct LoxInstance : public std::enable_shared_from_this<LoxInstance> {
-    std::shared_ptr<LoxClass> klass;
-    std::map<std::string, std::any> fields;
+// A method read as a value, e.g. stored in a variable. Calling a method
+// directly does not create one.
+struct LoxBoundMethod : LoxCallable {
+    LoxInstance *receiver;
+    LoxFunction *method;
 
-    LoxInstance(std::shared_ptr<LoxClass> klass) : klass(klass) {}
+    LoxBoundMethod(LoxInstance *receiver, LoxFunction *method) : LoxCallable(ObjType::BOUND_METHOD, method->arity), receiver(receiver), method(method) {}
 
-    std::any get(Token name) {
-        if (fields.count(name.lexeme)) {
-            return fields[name.lexeme];
-        }
-        if (auto method = klass->findMethod(name.lexeme); method) {
-            return std::static_pointer_cast<LoxCallable>(method->bind(shared_from_this()));
-        }
-        throw RunTimeError(name, "Undefined property '" + name.lexeme + "'.");
+    std::string toString() override {
+        return method->toString();
     }
 
-    void update(Token name, std::any value) {
-        fields[name.lexeme] = value;
+    size_t size() const override {
+        return sizeof(LoxBoundMethod);
     }
 
-    std::string toString() {
-        return "<" + klass->name + " object>";
+    void trace(Heap &heap) override {
+        heap.markObject(receiver);
+        heap.markObject(method);
     }
 };
 
+// The arguments are read before anything else runs, so they may point into
+// the value stack. Tail calls made by the body run here in turn, each in
+// place of the frame that made it, so they take no native stack. Such a
+// function stays on the value stack while it runs, as its body is not copied.
+inline Value LoxFunction::invoke(Interpreter &interpreter, Value *arguments, int argCount, LoxInstance *receiver) {
+    LoxFunction *function = this;
+    size_t base = interpreter.stack.size();
+    for (;;) {
+        if (Value result; interpreter.jit && !function->isMethod && interpreter.jit->tryCall(function, arguments, argCount, result)) {
+            interpreter.stack.resize(base);
+            return result;
+        }
+        auto environment = Environment::create(function->closure, function->declaration->frame);
+        if (function->isMethod) {
+            environment->define(receiver);
+        }
+        assert(function->arity == argCount);
+        for (int i = 0; i < argCount; i++) {
+            environment->define(arguments[i]);
+        }
+        interpreter.executeBlock(function->declaration->body, environment);
+        if (interpreter.completion != Completion::TAIL_CALL) {
+            interpreter.stack.resize(base);
+            return interpreter.completeCall();
+        }
+
+        // The pending arguments stay where they are until the next frame holds them.
+        interpreter.completion = Completion::NORMAL;
+        function = interpreter.tailFunction;
+        receiver = interpreter.tailReceiver;
+        arguments = interpreter.tailArguments.data();
+        argCount = interpreter.tailArguments.size();
+        interpreter.tailFunction = nullptr;
+        interpreter.tailReceiver = nullptr;
+        interpreter.stack.resize(base);
+        interpreter.stack.push_back(function);
+    }
+}
+
+// The instance is reachable from the initializer's frame while it runs.
+inline Value LoxClass::instantiate(Interpreter &interpreter, Value *arguments, int argCount) {
+    auto instance = LoxInstance::create(this);
+    if (initializer) {
+        initializer->invoke(interpreter, arguments, argCount, instance);
+    }
+    return instance;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+// Just enough of an x86-64 encoder for the JIT: scalar double arithmetic in
+// xmm0-xmm2, rbp-relative frame slots and rel32 jumps to labels.
+struct Assembler {
+    enum Condition : uint8_t {
+        BELOW = 0x2,          // CF=1
+        ABOVE_EQUAL = 0x3,    // CF=0
+        EQUAL = 0x4,          // ZF=1
+        NOT_EQUAL = 0x5,      // ZF=0
+        BELOW_EQUAL = 0x6,    // CF=1 or ZF=1
+        ABOVE = 0x7,          // CF=0 and ZF=0
+        PARITY = 0xa,         // PF=1, set by unordered comparisons
+    };
+
+    enum Arith : uint8_t {
+        ADD = 0x58,
+        MUL = 0x59,
+        SUB = 0x5c,
+        DIV = 0x5e,
+    };
+
+    std::vector<uint8_t> code;
+    // Bound offset of each label, -1 while unbound.
+    std::vector<int> labels;
+    // rel32 fields to patch: offset of the field and its label.
+    std::vector<std::pair<int, int>> fixups;
+
+    void byte(uint8_t b) {
+        code.push_back(b);
+    }
+
+    void bytes(std::initializer_list<uint8_t> bs) {
+        code.insert(code.end(), bs);
+    }
+
+    void imm32(int32_t value) {
+        for (int i = 0; i < 4; i++) {
+            byte((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    void imm64(uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            byte((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    int newLabel() {
+        labels.push_back(-1);
+        return labels.size() - 1;
+    }
+
+    void bind(int label) {
+        labels[label] = code.size();
+    }
+
+    void rel32(int label) {
+        fixups.push_back({int(code.size()), label});
+        imm32(0);
+    }
+
+    void jmp(int label) {
+        byte(0xe9);
+        rel32(label);
+    }
+
+    void jcc(Condition condition, int label) {
+        bytes({0x0f, uint8_t(0x80 | condition)});
+        rel32(label);
+    }
+
+    // Resolves all jumps once every label is bound.
+    void link() {
+        for (auto [offset, label] : fixups) {
+            assert(labels[label] >= 0);
+            int32_t delta = labels[label] - (offset + 4);
+            std::memcpy(&code[offset], &delta, 4);
+        }
+        fixups.clear();
+    }
+
+    // movsd xmm, [rbp + disp]
+    void loadSlot(int xmm, int32_t disp) {
+        bytes({0xf2, 0x0f, 0x10, uint8_t(0x85 | (xmm << 3))});
+        imm32(disp);
+    }
+
+    // movsd [rbp + disp], xmm
+    void storeSlot(int32_t disp, int xmm) {
+        bytes({0xf2, 0x0f, 0x11, uint8_t(0x85 | (xmm << 3))});
+        imm32(disp);
+    }
+
+    // movsd xmm, [rsi + disp]
+    void loadArgument(int xmm, int32_t disp) {
+        bytes({0xf2, 0x0f, 0x10, uint8_t(0x86 | (xmm << 3))});
+        imm32(disp);
+    }
+
+    // movsd [r12], xmm0
+    void storeResult() {
+        bytes({0xf2, 0x41, 0x0f, 0x11, 0x04, 0x24});
+    }
+
+    // mov rax, bits; movq xmm, rax
+    void loadConstant(int xmm, double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, 8);
+        bytes({0x48, 0xb8});
+        imm64(bits);
+        bytes({0x66, 0x48, 0x0f, 0x6e, uint8_t(0xc0 | (xmm << 3))});
+    }
+
+    // movsd dst, src
+    void move(int dst, int src) {
+        bytes({0xf2, 0x0f, 0x10, uint8_t(0xc0 | (dst << 3) | src)});
+    }
+
+    // op dst, src
+    void arith(Arith op, int dst, int src) {
+        bytes({0xf2, 0x0f, op, uint8_t(0xc0 | (dst << 3) | src)});
+    }
+
+    // ucomisd a, b
+    void compare(int a, int b) {
+        bytes({0x66, 0x0f, 0x2e, uint8_t(0xc0 | (a << 3) | b)});
+    }
+
+    // xorpd xmm, xmm
+    void zero(int xmm) {
+        bytes({0x66, 0x0f, 0x57, uint8_t(0xc0 | (xmm << 3) | xmm)});
+    }
+
+    // Flips the sign bit of xmm0 through rax.
+    void negate() {
+        bytes({0x66, 0x48, 0x0f, 0x7e, 0xc0});     // movq rax, xmm0
+        bytes({0x48, 0x0f, 0xba, 0xf8, 0x3f});     // btc rax, 63
+        bytes({0x66, 0x48, 0x0f, 0x6e, 0xc0});     // movq xmm0, rax
+    }
+
+    void movEax(int32_t value) {
+        byte(0xb8);
+        imm32(value);
+    }
+
+    void testEax() {
+        bytes({0x85, 0xc0});
+    }
+};
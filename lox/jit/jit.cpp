@@ -0,0 +1,579 @@
+#include "jit.hpp"
+#include "assembler.hpp"
+#include "../interpreter/objects.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+namespace {
+
+const int MAX_ARGUMENTS = 16;
+
+// Translates one function declaration to machine code, or gives up (ok is
+// cleared) on anything that is not numeric and free of side effects. All
+// values are unboxed doubles: locals live in frame slots below rbp,
+// temporaries after them, and expressions leave their value in xmm0.
+struct CodeGenerator : VisitorExpr, VisitorStmt {
+    struct Scope {
+        int base;
+        int size;
+        int defined;
+    };
+
+    struct Loop {
+        int breakLabel;
+        int continueLabel;
+    };
+
+    Assembler a;
+    bool ok;
+    std::vector<Scope> scopes;
+    std::vector<Loop> loops;
+    int numSlots;
+    int temps;
+    int maxTemps;
+    int epilogue;
+    int bail;
+
+    CodeGenerator() : ok(true), numSlots(0), temps(0), maxTemps(0) {}
+
+    // Slots used by a statement's nested blocks, each block placed after its parent's locals.
+    static int slotsNeeded(const std::shared_ptr<Stmt> &stmt, int end) {
+        if (auto block = std::dynamic_pointer_cast<BlockStmt>(stmt); block) {
+            int blockEnd = end + block->frame.numLocals;
+            int needed = blockEnd;
+            for (auto &statement : block->statements) {
+                needed = std::max(needed, slotsNeeded(statement, blockEnd));
+            }
+            return needed;
+        } else if (auto ifStmt = std::dynamic_pointer_cast<IfStmt>(stmt); ifStmt) {
+            return std::max(slotsNeeded(ifStmt->then, end), ifStmt->elsee ? slotsNeeded(ifStmt->elsee, end) : end);
+        } else if (auto whileStmt = std::dynamic_pointer_cast<WhileStmt>(stmt); whileStmt) {
+            return slotsNeeded(whileStmt->body, end);
+        } else if (auto forStmt = std::dynamic_pointer_cast<ForStmt>(stmt); forStmt) {
+            int loopEnd = end + forStmt->frame.numLocals;
+            return std::max(loopEnd, slotsNeeded(forStmt->body, loopEnd));
+        }
+        return end;
+    }
+
+    // Frame offsets: rbx and r12 are saved just below rbp.
+    static int32_t slotDisp(int slot) {
+        return -24 - 8 * slot;
+    }
+
+    int32_t tempDisp(int temp) {
+        return slotDisp(numSlots + temp);
+    }
+
+    int allocateTemps(int count) {
+        temps += count;
+        maxTemps = std::max(maxTemps, temps);
+        return temps - count;
+    }
+
+    bool localSlot(LocalSlot local, int &slot) {
+        if (!local.isLocal() || local.depth >= int(scopes.size())) {
+            return false;
+        }
+        slot = scopes[scopes.size() - 1 - local.depth].base + local.slot;
+        return true;
+    }
+
+    void generate(FunctionStmt *declaration) {
+        int arity = declaration->parameters.size();
+        if (arity > MAX_ARGUMENTS || declaration->frame.captured) {
+            ok = false;
+            return;
+        }
+        numSlots = declaration->frame.numLocals;
+        for (auto &statement : declaration->body) {
+            numSlots = std::max(numSlots, slotsNeeded(statement, declaration->frame.numLocals));
+        }
+        scopes.push_back({0, declaration->frame.numLocals, arity});
+        epilogue = a.newLabel();
+        bail = a.newLabel();
+
+        // push rbp; mov rbp, rsp; push rbx; push r12; sub rsp, frame
+        a.bytes({0x55, 0x48, 0x89, 0xe5, 0x53, 0x41, 0x54, 0x48, 0x81, 0xec});
+        int frameSize = a.code.size();
+        a.imm32(0);
+        // mov rbx, rdi; mov r12, rdx
+        a.bytes({0x48, 0x89, 0xfb, 0x49, 0x89, 0xd4});
+        for (int i = 0; i < arity; i++) {
+            a.loadArgument(0, 8 * i);
+            a.storeSlot(slotDisp(i), 0);
+        }
+
+        for (auto &statement : declaration->body) {
+            statement->accept(*this);
+        }
+        a.movEax(2);
+
+        a.bind(epilogue);
+        // lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret
+        a.bytes({0x48, 0x8d, 0x65, 0xf0, 0x41, 0x5c, 0x5b, 0x5d, 0xc3});
+        a.bind(bail);
+        a.movEax(0);
+        a.jmp(epilogue);
+        a.link();
+
+        // Keeps rsp 16 byte aligned at calls.
+        int32_t frame = (8 * (numSlots + maxTemps) + 15) & ~15;
+        std::memcpy(&a.code[frameSize], &frame, 4);
+    }
+
+    // Leaves lhs in xmm0 and rhs in xmm1. A local or a constant on the right
+    // is loaded directly instead of going through a temporary.
+    void operands(BinaryExpr *expr) {
+        expr->lhs->accept(*this);
+        int slot;
+        if (auto literal = dynamic_cast<LiteralExpr*>(expr->rhs.get()); literal && literal->value.isNumber()) {
+            a.loadConstant(1, literal->value.asNumber());
+        } else if (auto variable = dynamic_cast<VariableExpr*>(expr->rhs.get()); variable && localSlot(variable->local, slot)) {
+            a.loadSlot(1, slotDisp(slot));
+        } else {
+            int temp = allocateTemps(1);
+            a.storeSlot(tempDisp(temp), 0);
+            expr->rhs->accept(*this);
+            a.move(1, 0);
+            a.loadSlot(0, tempDisp(temp));
+            temps--;
+        }
+    }
+
+    // Jumps to label when expr is truthy (or falsey). Numbers are always truthy.
+    void condition(Expr *expr, int label, bool jumpIfTrue) {
+        if (auto grouping = dynamic_cast<GroupingExpr*>(expr); grouping) {
+            condition(grouping->expr.get(), label, jumpIfTrue);
+        } else if (auto literal = dynamic_cast<LiteralExpr*>(expr); literal) {
+            if (isTruthy(literal->value) == jumpIfTrue) {
+                a.jmp(label);
+            }
+        } else if (auto unary = dynamic_cast<UnaryExpr*>(expr); unary && unary->op.type == TokenType::BANG) {
+            condition(unary->expr.get(), label, !jumpIfTrue);
+        } else if (auto logical = dynamic_cast<LogicalExpr*>(expr); logical) {
+            bool isOr = logical->op.type == TokenType::OR;
+            if (isOr == jumpIfTrue) {
+                condition(logical->lhs.get(), label, jumpIfTrue);
+                condition(logical->rhs.get(), label, jumpIfTrue);
+            } else {
+                int skip = a.newLabel();
+                condition(logical->lhs.get(), skip, !jumpIfTrue);
+                condition(logical->rhs.get(), label, jumpIfTrue);
+                a.bind(skip);
+            }
+        } else if (auto binary = dynamic_cast<BinaryExpr*>(expr); binary && comparison(binary, label, jumpIfTrue)) {
+        } else {
+            expr->accept(*this);
+            if (jumpIfTrue) {
+                a.jmp(label);
+            }
+        }
+    }
+
+    // Unordered comparisons (NaN) are false, like in the interpreter.
+    bool comparison(BinaryExpr *expr, int label, bool jumpIfTrue) {
+        switch (expr->op.type) {
+            case TokenType::GREATER:
+                operands(expr);
+                a.compare(0, 1);
+                a.jcc(jumpIfTrue ? Assembler::ABOVE : Assembler::BELOW_EQUAL, label);
+                return true;
+            case TokenType::GREATER_EQUAL:
+                operands(expr);
+                a.compare(0, 1);
+                a.jcc(jumpIfTrue ? Assembler::ABOVE_EQUAL : Assembler::BELOW, label);
+                return true;
+            case TokenType::LESS:
+                operands(expr);
+                a.compare(1, 0);
+                a.jcc(jumpIfTrue ? Assembler::ABOVE : Assembler::BELOW_EQUAL, label);
+                return true;
+            case TokenType::LESS_EQUAL:
+                operands(expr);
+                a.compare(1, 0);
+                a.jcc(jumpIfTrue ? Assembler::ABOVE_EQUAL : Assembler::BELOW, label);
+                return true;
+            case TokenType::EQUAL_EQUAL:
+            case TokenType::BANG_EQUAL: {
+                operands(expr);
+                a.compare(0, 1);
+                if (jumpIfTrue == (expr->op.type == TokenType::EQUAL_EQUAL)) {
+                    int skip = a.newLabel();
+                    a.jcc(Assembler::PARITY, skip);
+                    a.jcc(Assembler::EQUAL, label);
+                    a.bind(skip);
+                } else {
+                    a.jcc(Assembler::PARITY, label);
+                    a.jcc(Assembler::NOT_EQUAL, label);
+                }
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override {
+        if (!expr->value.isNumber()) {
+            ok = false;
+            return;
+        }
+        a.loadConstant(0, expr->value.asNumber());
+    }
+
+    void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override {
+        expr->expr->accept(*this);
+    }
+
+    void visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) override {
+        Assembler::Arith op;
+        switch (expr->op.type) {
+            case TokenType::PLUS: op = Assembler::ADD; break;
+            case TokenType::MINUS: op = Assembler::SUB; break;
+            case TokenType::STAR: op = Assembler::MUL; break;
+            case TokenType::SLASH: op = Assembler::DIV; break;
+            default:
+                ok = false;
+                return;
+        }
+        operands(expr.get());
+        if (op == Assembler::DIV) {
+            // Division by zero is left to the interpreter to report.
+            int nonZero = a.newLabel();
+            a.zero(2);
+            a.compare(1, 2);
+            a.jcc(Assembler::PARITY, nonZero);
+            a.jcc(Assembler::EQUAL, bail);
+            a.bind(nonZero);
+        }
+        a.arith(op, 0, 1);
+    }
+
+    void visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) override {
+        ok = false;
+    }
+
+    void visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) override {
+        if (expr->op.type != TokenType::MINUS) {
+            ok = false;
+            return;
+        }
+        expr->expr->accept(*this);
+        a.negate();
+    }
+
+    void visitVariableExpr(std::shared_ptr<VariableExpr> expr) override {
+        int slot;
+        if (!localSlot(expr->local, slot)) {
+            ok = false;
+            return;
+        }
+        a.loadSlot(0, slotDisp(slot));
+    }
+
+    void visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) override {
+        int slot;
+        if (!localSlot(expr->local, slot)) {
+            ok = false;
+            return;
+        }
+        expr->expr->accept(*this);
+        a.storeSlot(slotDisp(slot), 0);
+    }
+
+    // Arguments go to consecutive temporaries, the first at the lowest
+    // address, followed by the result.
+    void visitCallExpr(std::shared_ptr<CallExpr> expr) override {
+        auto callee = std::dynamic_pointer_cast<VariableExpr>(expr->callee);
+        int argCount = expr->arguments.size();
+        if (!callee || callee->local.isLocal() || callee->global < 0 || argCount > MAX_ARGUMENTS) {
+            ok = false;
+            return;
+        }
+        int base = allocateTemps(argCount + 1);
+        for (int i = 0; i < argCount; i++) {
+            expr->arguments[i]->accept(*this);
+            a.storeSlot(tempDisp(base + argCount - 1 - i), 0);
+        }
+        int32_t argumentsDisp = tempDisp(base + argCount - 1);
+        int32_t resultDisp = tempDisp(base + argCount);
+
+        a.bytes({0x48, 0x89, 0xdf});            // mov rdi, rbx
+        a.byte(0xbe);                           // mov esi, slot
+        a.imm32(callee->global);
+        a.bytes({0x48, 0x8d, 0x95});            // lea rdx, [rbp + arguments]
+        a.imm32(argumentsDisp);
+        a.byte(0xb9);                           // mov ecx, argCount
+        a.imm32(argCount);
+        a.bytes({0x4c, 0x8d, 0x85});            // lea r8, [rbp + result]
+        a.imm32(resultDisp);
+        a.bytes({0x48, 0xb8});                  // mov rax, Jit::callGlobal
+        a.imm64(reinterpret_cast<uint64_t>(&Jit::callGlobal));
+        a.bytes({0xff, 0xd0});                  // call rax
+        a.testEax();
+        a.jcc(Assembler::EQUAL, bail);
+        a.loadSlot(0, resultDisp);
+        temps = base;
+    }
+
+    void visitGetExpr(std::shared_ptr<GetExpr> expr) override { ok = false; }
+    void visitSetExpr(std::shared_ptr<SetExpr> expr) override { ok = false; }
+    void visitThisExpr(std::shared_ptr<ThisExpr> expr) override { ok = false; }
+    void visitSuperExpr(std::shared_ptr<SuperExpr> expr) override { ok = false; }
+
+    void visitBreakStmt(std::shared_ptr<BreakStmt> stmt) override {
+        if (loops.empty()) {
+            ok = false;
+            return;
+        }
+        a.jmp(loops.back().breakLabel);
+    }
+
+    void visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) override {
+        if (loops.empty()) {
+            ok = false;
+            return;
+        }
+        a.jmp(loops.back().continueLabel);
+    }
+
+    void visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override {
+        stmt->expr->accept(*this);
+    }
+
+    void visitPrintStmt(std::shared_ptr<PrintStmt> stmt) override {
+        ok = false;
+    }
+
+    void visitVarStmt(std::shared_ptr<VarStmt> stmt) override {
+        if (!stmt->initializer) {
+            ok = false;
+            return;
+        }
+        stmt->initializer->accept(*this);
+        Scope &scope = scopes.back();
+        a.storeSlot(slotDisp(scope.base + scope.defined++), 0);
+    }
+
+    void visitBlockStmt(std::shared_ptr<BlockStmt> stmt) override {
+        scopes.push_back({scopes.back().base + scopes.back().size, stmt->frame.numLocals, 0});
+        for (auto &statement : stmt->statements) {
+            statement->accept(*this);
+        }
+        scopes.pop_back();
+    }
+
+    void visitIfStmt(std::shared_ptr<IfStmt> stmt) override {
+        int elseLabel = a.newLabel();
+        int end = a.newLabel();
+        condition(stmt->guard.get(), elseLabel, false);
+        stmt->then->accept(*this);
+        a.jmp(end);
+        a.bind(elseLabel);
+        if (stmt->elsee) {
+            stmt->elsee->accept(*this);
+        }
+        a.bind(end);
+    }
+
+    void visitWhileStmt(std::shared_ptr<WhileStmt> stmt) override {
+        int start = a.newLabel();
+        int end = a.newLabel();
+        int next = a.newLabel();
+        a.bind(start);
+        condition(stmt->cond.get(), end, false);
+        loops.push_back({end, next});
+        stmt->body->accept(*this);
+        a.bind(next);
+        loops.pop_back();
+        a.jmp(start);
+        a.bind(end);
+    }
+
+    // Continue runs the increment.
+    void visitForStmt(std::shared_ptr<ForStmt> stmt) override {
+        scopes.push_back({scopes.back().base + scopes.back().size, stmt->frame.numLocals, 0});
+        if (stmt->initializer) {
+            stmt->initializer->accept(*this);
+        }
+        int start = a.newLabel();
+        int end = a.newLabel();
+        int next = a.newLabel();
+        a.bind(start);
+        if (stmt->cond) {
+            condition(stmt->cond.get(), end, false);
+        }
+        loops.push_back({end, next});
+        stmt->body->accept(*this);
+        a.bind(next);
+        if (stmt->increment) {
+            stmt->increment->accept(*this);
+        }
+        loops.pop_back();
+        a.jmp(start);
+        a.bind(end);
+        scopes.pop_back();
+    }
+
+    void visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override { ok = false; }
+    void visitClassStmt(std::shared_ptr<ClassStmt> stmt) override { ok = false; }
+
+    void visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override {
+        if (stmt->expr) {
+            stmt->expr->accept(*this);
+            a.storeResult();
+            a.movEax(1);
+        } else {
+            a.movEax(2);
+        }
+        a.jmp(epilogue);
+    }
+};
+
+}
+
+Jit::~Jit() {
+#if JIT_SUPPORTED
+    for (auto [memory, size] : regions) {
+        munmap(memory, size);
+    }
+#endif
+}
+
+JitEntry &Jit::entry(FunctionStmt *declaration) {
+    if (!declaration->native) {
+        declaration->native = std::make_shared<JitEntry>();
+    }
+    return *declaration->native;
+}
+
+bool Jit::compile(FunctionStmt *declaration, JitEntry &entry) {
+    entry.state = JitEntry::State::REJECTED;
+#if JIT_SUPPORTED
+    CodeGenerator generator;
+    generator.generate(declaration);
+    if (!generator.ok) {
+        return false;
+    }
+
+    auto &code = generator.a.code;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return false;
+    }
+    regions.push_back({memory, size});
+
+    entry.state = JitEntry::State::COMPILED;
+    entry.code = reinterpret_cast<JitCode>(memory);
+    entry.size = code.size();
+    log.push_back("compiled " + declaration->name.lexeme + " (" + std::to_string(entry.size) + " bytes)");
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The code stays mapped: it may be on the native stack right now. A bailout
+// unwinds through every native frame of the function, so only the first one
+// changes anything.
+void Jit::deoptimize(FunctionStmt *declaration, JitEntry &entry) {
+    if (entry.state == JitEntry::State::DEOPTIMIZED) {
+        return;
+    }
+    entry.state = JitEntry::State::DEOPTIMIZED;
+    log.push_back("deoptimized " + declaration->name.lexeme);
+}
+
+// The same bound as Interpreter::checkStack, which reports the overflow.
+bool Jit::stackLeft() {
+    return size_t(stackBase - static_cast<char*>(__builtin_frame_address(0))) <= stackLimit;
+}
+
+bool Jit::tryCall(LoxFunction *function, const Value *arguments, int argCount, Value &result) {
+    if (function->isMethod || !stackLeft()) {
+        return false;
+    }
+    FunctionStmt *declaration = function->declaration.get();
+    JitEntry &entry = this->entry(declaration);
+    if (entry.state == JitEntry::State::COLD && ++entry.calls >= HOT_CALLS) {
+        compile(declaration, entry);
+    }
+    if (entry.state != JitEntry::State::COMPILED) {
+        return false;
+    }
+
+    double numbers[MAX_ARGUMENTS];
+    for (int i = 0; i < argCount; i++) {
+        if (!arguments[i].isNumber()) {
+            return false;
+        }
+        numbers[i] = arguments[i].asNumber();
+    }
+
+    double number;
+    switch (entry.code(this, numbers, &number)) {
+        case 1:
+            result = number;
+            return true;
+        case 2:
+            result = nullptr;
+            return true;
+        default:
+            if (exhausted) {
+                exhausted = false;
+            } else {
+                deoptimize(declaration, entry);
+            }
+            return false;
+    }
+}
+
+int Jit::callGlobal(Jit *jit, int slot, const double *arguments, int argCount, double *result) {
+    if (!jit->globals.defined[slot] || !jit->globals.values[slot].isObjType(ObjType::FUNCTION)) {
+        return 0;
+    }
+    auto function = jit->globals.values[slot].asObj<LoxFunction>();
+    FunctionStmt *declaration = function->declaration.get();
+    if (function->isMethod || int(declaration->parameters.size()) != argCount || jit->depth == MAX_DEPTH) {
+        return 0;
+    }
+    JitEntry &entry = jit->entry(declaration);
+    if (entry.state == JitEntry::State::COLD) {
+        jit->compile(declaration, entry);
+    }
+    if (entry.state != JitEntry::State::COMPILED) {
+        return 0;
+    }
+    if (!jit->stackLeft()) {
+        jit->exhausted = true;
+        return 0;
+    }
+
+    jit->depth++;
+    int status = entry.code(jit, arguments, result);
+    jit->depth--;
+    if (status == 0 && !jit->exhausted) {
+        jit->deoptimize(declaration, entry);
+    }
+    // A nil result cannot continue as a number either.
+    return status == 1;
+}
+
+void Jit::print(std::ostream &out) {
+    for (auto &line : log) {
+        out << "[jit] " << line << "\n";
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "../ast/ast.hpp"
+#include "../interpreter/globals.hpp"
+
+struct Jit;
+struct LoxFunction;
+
+// Returns 1 with a number in *result, 2 when the function returned nil, or
+// 0 when a guard failed and the call has to run in the interpreter instead.
+typedef int (*JitCode)(Jit *jit, const double *arguments, double *result);
+
+// Native code for a function declaration, or why there is none.
+struct JitEntry {
+    enum class State {
+        COLD,
+        COMPILED,
+        REJECTED,
+        DEOPTIMIZED
+    };
+
+    State state = State::COLD;
+    int calls = 0;
+    JitCode code = nullptr;
+    size_t size = 0;
+};
+
+// Baseline JIT for functions that only compute with numbers: parameters and
+// locals, arithmetic, comparisons in conditions, loops and calls to global
+// functions of the same kind. Such functions have no side effects, so when
+// a guard fails (a non-number result, a division by zero, a callee that
+// cannot be compiled) the code just gives up and the interpreter runs the
+// whole call again, reporting any error itself.
+//
+// Native code shares the interpreter's stack and stops at the same limit.
+// Running out of it is not the function's fault, so it gives up without
+// deoptimizing, and the interpreter reports the overflow once it gets there.
+struct Jit {
+    static const int HOT_CALLS = 10;
+    static const int MAX_DEPTH = 10000;
+
+    GlobalTable &globals;
+    // Executable mappings, unmapped when the JIT goes away.
+    std::vector<std::pair<void*, size_t>> regions;
+    std::vector<std::string> log;
+    int depth;
+    char *stackBase;
+    size_t stackLimit;
+    // Set while native frames give up because the stack ran out.
+    bool exhausted;
+
+    Jit(GlobalTable &globals, char *stackBase, size_t stackLimit) : globals(globals), depth(0), stackBase(stackBase), stackLimit(stackLimit), exhausted(false) {}
+    ~Jit();
+
+    // Runs function natively if it is hot and compiles. False means the
+    // caller has to interpret the call.
+    bool tryCall(LoxFunction *function, const Value *arguments, int argCount, Value &result);
+
+    void print(std::ostream &out);
+
+    // Called from native code for calls to global functions.
+    static int callGlobal(Jit *jit, int slot, const double *arguments, int argCount, double *result);
+
+private:
+    JitEntry &entry(FunctionStmt *declaration);
+    bool compile(FunctionStmt *declaration, JitEntry &entry);
+    void deoptimize(FunctionStmt *declaration, JitEntry &entry);
+    bool stackLeft();
+};
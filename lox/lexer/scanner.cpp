@@ -29,7 +29,7 @@ std::vector<Token> Scanner::scanTokens() {
         scanToken();
     }
 
-    tokens.push_back(Token(TokenType::END_OF_FILE, "", "", line));
+    tokens.push_back(Token(TokenType::END_OF_FILE, "", nullptr, line));
     return tokens;
 }
 
@@ -76,10 +76,10 @@ void Scanner::scanToken() {
 }
 
 void Scanner::addToken(TokenType type) {
-    addToken(type, "");
+    addToken(type, nullptr);
 }
 
-void Scanner::addToken(TokenType type, std::any literal) {
+void Scanner::addToken(TokenType type, Value literal) {
     std::string lexeme = std::string(source.begin() + start, source.begin() + current);
     tokens.push_back(Token(type, lexeme, literal, line));
 }
@@ -125,7 +125,7 @@ void Scanner::string() {
     advance();
 
     std::string literal(source.begin() + start + 1, source.begin() + current - 1);
-    addToken(TokenType::STRING, literal);
+    addToken(TokenType::STRING, heap().pin(intern(literal)));
 }
 
 bool Scanner::isDigit(char c) {
@@ -165,6 +165,6 @@ void Scanner::identifier() {
 
     std::string word(source.begin() + start, source.begin() + current);
     TokenType type = (keywords.count(word) ? keywords[word] : TokenType::IDENTIFIER);
-    addToken(type);
+    addToken(type, heap().pin(intern(word)));
 }
 
@@ -3,6 +3,7 @@
 #include <bits/stdc++.h>
 
 #include "token.hpp"
+#include "../runtime/heap.hpp"
 #include "../error/error_handler.hpp"
 
 struct Scanner {
@@ -29,7 +30,7 @@ private:
 
     void addToken(TokenType type);
 
-    void addToken(TokenType type, std::any literal);
+    void addToken(TokenType type, Value literal);
 
     bool match(char expected);
 
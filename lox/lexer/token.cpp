@@ -1,9 +1,13 @@
 #include "token.hpp"
 
-Token::Token(TokenType type, std::string lexeme, std::any literal, int line) :
+Token::Token(TokenType type, std::string lexeme, Value literal, int line) :
     type(type), lexeme(lexeme), literal(literal), line(line) {}
 
 std::string Token::toString() {
     return lexeme;
 }
 
+
+ObjString *Token::identifier() const {
+    return literal.asString();
+}
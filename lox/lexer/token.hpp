@@ -2,6 +2,9 @@
 
 #include <bits/stdc++.h>
 
+#include "../runtime/value.hpp"
+#include "../runtime/string_table.hpp"
+
 enum class TokenType {
     // single character
     LEFT_PAREN,
@@ -34,11 +37,13 @@ enum class TokenType {
 struct Token {
     TokenType type;
     std::string lexeme;
-    std::any literal;
+    // Number or string value of a literal; the interned name for identifiers and keywords.
+    Value literal;
     int line;
 
-    Token(TokenType type, std::string lexeme, std::any literal, int line);
+    Token(TokenType type, std::string lexeme, Value literal, int line);
 
     std::string toString();
+    ObjString *identifier() const;
 };
 
@@ -5,63 +5,234 @@
 #include "parser/parser.hpp"
 #include "ast/ast_printer.hpp"
 #include "interpreter/interpreter.hpp"
+#include "interpreter/closure_compiler.hpp"
 #include "analysis/resolver.hpp"
+#include "analysis/optimizer.hpp"
+#include "analysis/type_inference.hpp"
+#include "vm/compiler.hpp"
+#include "vm/vm.hpp"
+#include "jit/jit.hpp"
 
-void run(std::string source, ErrorHandler &errorHandler, Interpreter &interpreter) {
+TypeStats typeStats;
+
+// Scans, parses, resolves and optimizes the source, with globals assigned slots in globals.
+std::vector<std::shared_ptr<Stmt>> analyze(std::string source, ErrorHandler &errorHandler, GlobalTable &globals) {
     Scanner scanner(source, errorHandler);
     auto tokens = scanner.scanTokens();
 
-    if (errorHandler.hadError) return;
+    if (errorHandler.hadError) return {};
 
     Parser parser(tokens, errorHandler);
     std::vector<std::shared_ptr<Stmt>> ast = parser.parse();
 
-    if (errorHandler.hadError) return;
+    if (errorHandler.hadError) return {};
 
-    Resolver resolver(interpreter, errorHandler);
+    Resolver resolver(globals, errorHandler);
     resolver.resolve(ast);
 
+    if (errorHandler.hadError) return {};
+
+    Optimizer optimizer;
+    optimizer.optimize(ast);
+
+    TypeInference inference(typeStats);
+    inference.infer(ast);
+
+    return ast;
+}
+
+void run(std::string source, ErrorHandler &errorHandler, Interpreter &interpreter) {
+    auto ast = analyze(source, errorHandler, interpreter.globals);
+
+    if (errorHandler.hadError) return;
+
+    interpreter.interpret(ast);
+}
+
+void run(std::string source, ErrorHandler &errorHandler, ClosureInterpreter &interpreter) {
+    auto ast = analyze(source, errorHandler, interpreter.globals);
+
     if (errorHandler.hadError) return;
 
     interpreter.interpret(ast);
 }
 
-void runFile(char *filePath) {
+void run(std::string source, ErrorHandler &errorHandler, VM &vm) {
+    auto ast = analyze(source, errorHandler, vm.globals);
+
+    if (errorHandler.hadError) return;
+
+    Compiler compiler(vm.globals, errorHandler);
+    VmFunction *script = compiler.compile(ast);
+
+    if (errorHandler.hadError) return;
+
+    vm.interpret(script);
+}
+
+struct Options {
+    bool gcStats = false;
+    bool icStats = false;
+    bool closures = false;
+    bool vm = false;
+    bool jit = false;
+    bool jitStats = false;
+    bool typeStats = false;
+    bool tailCalls = true;
+    // Bytes Lox frames may take, unless the native stack runs out first.
+    size_t stackLimit = 64 << 20;
+};
+
+void configure(Options &options, Interpreter &interpreter) {
+    interpreter.tailCalls = options.tailCalls;
+    interpreter.stackLimit = std::min(interpreter.stackLimit, options.stackLimit);
+}
+
+void configure(Options &options, VM &vm) {
+    vm.stackLimit = options.stackLimit;
+}
+
+// The JIT plugs into the tree-walking engines' calls.
+std::unique_ptr<Jit> attachJit(Options &options, Interpreter &interpreter) {
+    if (!options.jit) {
+        return nullptr;
+    }
+    auto jit = std::make_unique<Jit>(interpreter.globals, interpreter.stackBase, interpreter.stackLimit);
+    interpreter.jit = jit.get();
+    return jit;
+}
+
+std::unique_ptr<Jit> attachJit(Options &options, VM &vm) {
+    return nullptr;
+}
+
+void report(Options &options, InlineCacheStats *cacheStats) {
+    if (options.gcStats) {
+        heap().printStats(std::cerr);
+    }
+    if (options.icStats && cacheStats) {
+        cacheStats->print(std::cerr);
+    }
+    if (options.typeStats) {
+        typeStats.print(std::cerr);
+    }
+}
+
+void report(Options &options, Interpreter &interpreter) {
+    report(options, &interpreter.cacheStats);
+    if (options.jitStats && interpreter.jit) {
+        interpreter.jit->print(std::cerr);
+    }
+}
+
+void report(Options &options, VM &vm) {
+    report(options, nullptr);
+}
+
+template <typename Engine>
+void runFile(char *filePath, Options &options) {
     std::ifstream t(filePath);
     std::stringstream buffer;
     buffer << t.rdbuf();
 
     ErrorHandler errorHandler;
-    Interpreter interpreter(errorHandler);
-    run(buffer.str(), errorHandler, interpreter);
+    Engine engine(errorHandler);
+    configure(options, engine);
+    auto jit = attachJit(options, engine);
+    run(buffer.str(), errorHandler, engine);
+    report(options, engine);
 
     if (errorHandler.hadError) {
         exit(65);
     }
 }
 
-void runPrompt() {
+template <typename Engine>
+void runPrompt(Options &options) {
     std::string line;
     ErrorHandler errorHandler;
-    Interpreter interpreter(errorHandler);
+    Engine engine(errorHandler);
+    configure(options, engine);
+    auto jit = attachJit(options, engine);
 
     for (;;) {
         std::cout << "> ";
         if (!std::getline(std::cin, line)) break;
 
-        run(line, errorHandler, interpreter);
+        run(line, errorHandler, engine);
         errorHandler.hadError = false;
     }
+    report(options, engine);
+}
+
+void usage(char *program) {
+    std::cerr << "usage: " << program << " [--closures | --vm] [--jit] [--jit-stats] [--gc-stats] [--gc-growth=<factor>] [--ic-stats] [--type-stats] [--no-tail-calls] [--stack-limit=<megabytes>] [script]\n";
+    exit(64);
 }
 
 int main(int argc, char **argv) {
-    if (argc > 2) {
-        std::cerr << "usage: " << argv[0] << " [script]\n";
-        exit(64);
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    Options options;
+    std::vector<char*> scripts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--gc-stats") {
+            options.gcStats = true;
+        } else if (arg == "--ic-stats") {
+            options.icStats = true;
+        } else if (arg == "--closures") {
+            options.closures = true;
+        } else if (arg == "--vm") {
+            options.vm = true;
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--jit-stats") {
+            options.jitStats = true;
+        } else if (arg == "--type-stats") {
+            options.typeStats = true;
+        } else if (arg == "--no-tail-calls") {
+            options.tailCalls = false;
+        } else if (arg.rfind("--gc-growth=", 0) == 0) {
+            char *end;
+            double factor = std::strtod(arg.c_str() + strlen("--gc-growth="), &end);
+            if (*end != '\0' || !(factor > 1.0)) {
+                std::cerr << "Heap growth factor must be a number greater than 1.\n";
+                exit(64);
+            }
+            heap().growthFactor = factor;
+        } else if (arg.rfind("--stack-limit=", 0) == 0) {
+            char *end;
+            long megabytes = std::strtol(arg.c_str() + strlen("--stack-limit="), &end, 10);
+            if (*end != '\0' || megabytes <= 0) {
+                std::cerr << "Stack limit must be a positive number of megabytes.\n";
+                exit(64);
+            }
+            options.stackLimit = size_t(megabytes) << 20;
+        } else if (arg.rfind("--", 0) == 0) {
+            usage(argv[0]);
+        } else {
+            scripts.push_back(argv[i]);
+        }
+    }
+
+    if (scripts.size() > 1 || (options.closures && options.vm) || (options.jit && options.vm)) {
+        usage(argv[0]);
+    } else if (scripts.size() == 1) {
+        if (options.vm) {
+            runFile<VM>(scripts[0], options);
+        } else if (options.closures) {
+            runFile<ClosureInterpreter>(scripts[0], options);
+        } else {
+            runFile<Interpreter>(scripts[0], options);
+        }
     } else {
-        runPrompt();
+        if (options.vm) {
+            runPrompt<VM>(options);
+        } else if (options.closures) {
+            runPrompt<ClosureInterpreter>(options);
+        } else {
+            runPrompt<Interpreter>(options);
+        }
     }
 
     return 0;
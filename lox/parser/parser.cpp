@@ -296,48 +296,35 @@ std::shared_ptr<Stmt> Parser::whileStmt() {
     consume(TokenType::RIGHT_PAREN, "Expected ')' after condition.");
     auto body = statement();
 
-    return std::make_shared<WhileStmt>(cond, body, false);
+    return std::make_shared<WhileStmt>(cond, body);
 }
 
 std::shared_ptr<Stmt> Parser::forStmt() {
     consume(TokenType::LEFT_PAREN, "Expected '(' after 'for'.");
 
+    // Omitted clauses are left null.
     std::shared_ptr<Stmt> initializer;
-    if (match({TokenType::SEMICOLON})) {
-        initializer = std::make_shared<ExpressionStmt>(std::make_shared<LiteralExpr>(1));
-    } else if (match({TokenType::VAR})) {
+    if (match({TokenType::VAR})) {
         initializer = var();
-    } else {
+    } else if (!match({TokenType::SEMICOLON})) {
         initializer = expressionStmt();
     }
 
     std::shared_ptr<Expr> condition;
-    if (check({TokenType::SEMICOLON})) {
-        condition = std::make_shared<LiteralExpr>(true);
-    } else {
+    if (!check({TokenType::SEMICOLON})) {
         condition = expression();
     }
     consume(TokenType::SEMICOLON, "Expected ';' after loop condition.");
 
     std::shared_ptr<Expr> increment;
-    if (check({TokenType::RIGHT_PAREN})) {
-        increment = std::make_shared<LiteralExpr>(1);
-    } else {
+    if (!check({TokenType::RIGHT_PAREN})) {
         increment = expression();
     }
     consume(TokenType::RIGHT_PAREN, "Expected ')' after loop clauses.");
 
     std::shared_ptr<Stmt> body = statement();
 
-    return
-    std::make_shared<BlockStmt>(std::vector<std::shared_ptr<Stmt>>{
-        initializer,
-        std::make_shared<WhileStmt>(condition, 
-            std::make_shared<BlockStmt>(std::vector<std::shared_ptr<Stmt>>{
-                body,
-                std::make_shared<ExpressionStmt>(increment),
-            }), true)
-    });
+    return std::make_shared<ForStmt>(initializer, condition, increment, body);
 }
 
 std::vector<std::shared_ptr<Stmt>> Parser::block() {
@@ -0,0 +1,51 @@
+#include "arena.hpp"
+
+static const size_t CHUNK_SIZE = 64 * 1024;
+
+FrameArena::FrameArena() : current(0), bytesInUse(0), peakBytes(0), allocations(0) {
+    chunks.push_back({std::unique_ptr<char[]>(new char[CHUNK_SIZE]), CHUNK_SIZE});
+    top = chunks[0].memory.get();
+}
+
+void *FrameArena::reserve(size_t bytes) {
+    bytes = (bytes + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+    if (top + bytes <= chunks[current].memory.get() + chunks[current].size) {
+        void *memory = top;
+        top += bytes;
+        return memory;
+    }
+
+    // Move on to the next chunk. Chunks after the current one are unused, so
+    // one that is too small can simply be replaced.
+    size_t next = current + 1;
+    if (next == chunks.size() || chunks[next].size < bytes) {
+        size_t size = std::max(CHUNK_SIZE, bytes);
+        Chunk chunk{std::unique_ptr<char[]>(new char[size]), size};
+        if (next == chunks.size()) {
+            chunks.push_back(std::move(chunk));
+        } else {
+            chunks[next] = std::move(chunk);
+        }
+    }
+    current = next;
+    top = chunks[current].memory.get() + bytes;
+    return chunks[current].memory.get();
+}
+
+void FrameArena::release(Obj *object) {
+    assert(!frames.empty() && frames.back().object == object);
+    Frame frame = frames.back();
+    frames.pop_back();
+
+    object->~Obj();
+    current = frame.chunk;
+    top = frame.previousTop;
+    bytesInUse -= frame.bytes;
+}
+
+void FrameArena::unmarkAll() {
+    for (auto &frame : frames) {
+        frame.object->marked = false;
+    }
+}
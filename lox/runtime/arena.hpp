@@ -0,0 +1,53 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "value.hpp"
+
+// LIFO region for environment frames that no closure can capture. Frames are
+// bump allocated from reusable chunks and released in reverse order of
+// allocation, so entering and leaving a block costs a few pointer updates.
+struct FrameArena {
+    struct Chunk {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+
+    struct Frame {
+        Obj *object;
+        size_t bytes;
+        size_t chunk;
+        char *previousTop;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current;
+    char *top;
+    std::vector<Frame> frames;
+
+    size_t bytesInUse;
+    size_t peakBytes;
+    size_t allocations;
+
+    FrameArena();
+
+    template <typename T, typename... Args>
+    T *allocate(size_t bytes, Args&&... args) {
+        Frame frame{nullptr, bytes, current, top};
+        T *object = new (reserve(bytes)) T(std::forward<Args>(args)...);
+        frame.object = object;
+        frames.push_back(frame);
+
+        allocations++;
+        bytesInUse += bytes;
+        peakBytes = std::max(peakBytes, bytesInUse);
+        return object;
+    }
+
+    void release(Obj *object);
+    // Live frames are marked like heap objects during a collection, but are not swept.
+    void unmarkAll();
+
+private:
+    void *reserve(size_t bytes);
+};
@@ -0,0 +1,91 @@
+#include "heap.hpp"
+
+static const size_t INITIAL_GC_THRESHOLD = 1 << 20;
+
+Heap::Heap() : objects(nullptr), bytesAllocated(0), nextGC(INITIAL_GC_THRESHOLD), growthFactor(2.0) {}
+
+void Heap::collect() {
+    auto start = std::chrono::steady_clock::now();
+    stats.collections++;
+
+    for (auto object : pinned) {
+        markObject(object);
+    }
+    for (auto root : roots) {
+        root->markRoots(*this);
+    }
+    traceReferences();
+    sweep();
+    arena.unmarkAll();
+
+    nextGC = std::max(size_t(bytesAllocated * growthFactor), INITIAL_GC_THRESHOLD);
+
+    double pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.totalPauseMs += pause;
+    stats.maxPauseMs = std::max(stats.maxPauseMs, pause);
+}
+
+void Heap::addRoots(GcRoots *root) {
+    roots.push_back(root);
+}
+
+void Heap::removeRoots(GcRoots *root) {
+    roots.erase(std::find(roots.begin(), roots.end(), root));
+}
+
+void Heap::markObject(Obj *object) {
+    if (object == nullptr || object->marked) return;
+    object->marked = true;
+    grayStack.push_back(object);
+}
+
+void Heap::markValue(const Value &value) {
+    if (value.isObj()) {
+        markObject(value.asObj());
+    }
+}
+
+void Heap::traceReferences() {
+    while (!grayStack.empty()) {
+        Obj *object = grayStack.back();
+        grayStack.pop_back();
+        object->trace(*this);
+    }
+}
+
+void Heap::sweep() {
+    size_t live = 0;
+    Obj **link = &objects;
+    while (*link != nullptr) {
+        Obj *object = *link;
+        if (object->marked) {
+            object->marked = false;
+            live += object->size();
+            link = &object->next;
+        } else {
+            *link = object->next;
+            stats.objectsFreed++;
+            delete object;
+        }
+    }
+    // Sizes of objects grow after allocation (fields, flattened ropes), so
+    // resynchronize with what actually survived.
+    bytesAllocated = live;
+}
+
+void Heap::printStats(std::ostream &out) {
+    out << "[gc] collections:   " << stats.collections << "\n";
+    out << "[gc] allocated:     " << stats.objectsAllocated << " objects, " << stats.bytesAllocated << " bytes\n";
+    out << "[gc] freed:         " << stats.objectsFreed << " objects\n";
+    out << "[gc] live:          " << bytesAllocated << " bytes\n";
+    out << "[gc] peak heap:     " << stats.peakBytes << " bytes\n";
+    out << "[gc] growth factor: " << growthFactor << "\n";
+    out << "[gc] arena frames:  " << arena.allocations << " allocated, " << arena.peakBytes << " bytes peak\n";
+    out << "[gc] pause:         " << stats.totalPauseMs << " ms total, " << stats.maxPauseMs << " ms max\n";
+}
+
+Heap &heap() {
+    // Never destroyed, like the string table.
+    static Heap *heap = new Heap();
+    return *heap;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "value.hpp"
+#include "arena.hpp"
+
+// Anything that holds Values outside of the heap: the interpreter's
+// environments and value stack.
+struct GcRoots {
+    virtual void markRoots(Heap &heap) = 0;
+};
+
+struct GcStats {
+    size_t collections = 0;
+    size_t objectsAllocated = 0;
+    size_t objectsFreed = 0;
+    size_t bytesAllocated = 0;
+    size_t peakBytes = 0;
+    double totalPauseMs = 0;
+    double maxPauseMs = 0;
+};
+
+// Precise mark-sweep collector. Collections only happen at safepoints, where
+// every live value is reachable from a registered GcRoots or a pinned object.
+struct Heap {
+    Obj *objects;
+    size_t bytesAllocated;
+    size_t nextGC;
+    double growthFactor;
+    std::vector<GcRoots*> roots;
+    std::vector<Obj*> pinned;
+    std::vector<Obj*> grayStack;
+    GcStats stats;
+    FrameArena arena;
+
+    Heap();
+
+    template <typename T, typename... Args>
+    T *allocate(Args&&... args) {
+        return track(new T(std::forward<Args>(args)...));
+    }
+
+    // For objects with trailing storage. T must provide an unsized operator delete.
+    template <typename T, typename... Args>
+    T *allocateSized(size_t bytes, Args&&... args) {
+        return track(new (::operator new(bytes)) T(std::forward<Args>(args)...));
+    }
+
+    void safepoint() {
+        if (bytesAllocated > nextGC) {
+            collect();
+        }
+    }
+
+    void collect();
+    // Keeps an object alive for the rest of the program, e.g. names referenced from the AST.
+    template <typename T>
+    T *pin(T *object) {
+        if (!object->pinned) {
+            object->pinned = true;
+            pinned.push_back(object);
+        }
+        return object;
+    }
+
+    void addRoots(GcRoots *root);
+    void removeRoots(GcRoots *root);
+
+    void markObject(Obj *object);
+    void markValue(const Value &value);
+
+    void printStats(std::ostream &out);
+
+private:
+    template <typename T>
+    T *track(T *object) {
+        object->next = objects;
+        objects = object;
+
+        size_t size = object->size();
+        bytesAllocated += size;
+        stats.objectsAllocated++;
+        stats.bytesAllocated += size;
+        stats.peakBytes = std::max(stats.peakBytes, bytesAllocated);
+        return object;
+    }
+
+    void traceReferences();
+    void sweep();
+};
+
+Heap &heap();
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+struct Shape;
+struct LoxFunction;
+
+// Polymorphic inline cache attached to a property access. Each entry maps a
+// receiver shape to where the property was found for it. Entries hold raw
+// pointers, so the cache is emptied whenever a collection has run since it
+// was filled.
+struct InlineCache {
+    static const int MAX_ENTRIES = 4;
+
+    struct Entry {
+        Shape *shape;
+        // Field index, or -1 when the property is a method.
+        int index;
+        LoxFunction *method;
+        // For an assignment that adds the field, the shape after adding it.
+        Shape *transition;
+    };
+
+    Entry entries[MAX_ENTRIES];
+    int numEntries = 0;
+    size_t epoch = 0;
+
+    Entry *find(Shape *shape, size_t currentEpoch) {
+        if (epoch != currentEpoch) {
+            epoch = currentEpoch;
+            numEntries = 0;
+        }
+        for (int i = 0; i < numEntries; i++) {
+            if (entries[i].shape == shape) {
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // A site that has seen more shapes than fit stays on the slow path.
+    void add(Entry entry) {
+        if (numEntries < MAX_ENTRIES) {
+            entries[numEntries++] = entry;
+        }
+    }
+};
+
+struct InlineCacheStats {
+    size_t getHits = 0;
+    size_t getMisses = 0;
+    size_t setHits = 0;
+    size_t setMisses = 0;
+
+    void print(std::ostream &out) const {
+        out << "[ic] get: " << getHits << " hits, " << getMisses << " misses\n";
+        out << "[ic] set: " << setHits << " hits, " << setMisses << " misses\n";
+    }
+};
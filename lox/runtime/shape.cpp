@@ -0,0 +1,39 @@
+#include "shape.hpp"
+#include "heap.hpp"
+
+Shape::Shape(Shape *parent, ObjString *name) : Obj(ObjType::SHAPE), parent(parent) {
+    if (parent) {
+        names = parent->names;
+        names.push_back(name);
+    }
+}
+
+Shape *Shape::transition(ObjString *name) {
+    for (auto &[field, shape] : transitions) {
+        if (field == name) {
+            return shape;
+        }
+    }
+    Shape *shape = heap().allocate<Shape>(this, name);
+    transitions.emplace_back(name, shape);
+    return shape;
+}
+
+std::string Shape::toString() {
+    return "<shape>";
+}
+
+size_t Shape::size() const {
+    return sizeof(Shape) + names.size() * sizeof(ObjString*) + transitions.size() * sizeof(std::pair<ObjString*, Shape*>);
+}
+
+// Transitions are strong: a shape tree lives as long as its class or any instance using it.
+void Shape::trace(Heap &heap) {
+    heap.markObject(parent);
+    for (auto name : names) {
+        heap.markObject(name);
+    }
+    for (auto &[name, shape] : transitions) {
+        heap.markObject(shape);
+    }
+}
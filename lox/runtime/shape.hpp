@@ -0,0 +1,37 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "value.hpp"
+
+// Hidden class describing the field layout of instances: an instance with
+// this shape stores the field called names[i] at index i. Instances that
+// added the same fields in the same order share a shape, found by following
+// transitions from the root shape of their class.
+struct Shape : Obj {
+    Shape *parent;
+    std::vector<ObjString*> names;
+    std::vector<std::pair<ObjString*, Shape*>> transitions;
+
+    Shape(Shape *parent, ObjString *name);
+
+    int lookup(ObjString *name) const {
+        for (int i = 0; i < int(names.size()); i++) {
+            if (names[i] == name) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    int numFields() const {
+        return names.size();
+    }
+
+    // Shape reached by adding the field name, created on first use.
+    Shape *transition(ObjString *name);
+
+    std::string toString() override;
+    size_t size() const override;
+    void trace(Heap &heap) override;
+};
@@ -0,0 +1,162 @@
+#include "string_table.hpp"
+#include "heap.hpp"
+
+static ObjString *const TOMBSTONE = reinterpret_cast<ObjString*>(1);
+
+StringTable::StringTable() : entries(16, nullptr), count(0) {}
+
+ObjString *StringTable::find(const std::string &chars, uint32_t hash) {
+    size_t mask = entries.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        ObjString *entry = entries[i];
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        if (entry != TOMBSTONE && entry->hash == hash && entry->chars == chars) {
+            return entry;
+        }
+    }
+}
+
+void StringTable::insert(ObjString *string) {
+    // Tombstones count towards the load factor, so probing always terminates.
+    if (2 * (count + 1) > entries.size()) {
+        grow();
+    }
+    size_t mask = entries.size() - 1;
+    for (size_t i = string->hash & mask;; i = (i + 1) & mask) {
+        if (entries[i] == nullptr) {
+            count++;
+            entries[i] = string;
+            return;
+        }
+        if (entries[i] == TOMBSTONE) {
+            entries[i] = string;
+            return;
+        }
+    }
+}
+
+size_t StringTable::findSlot(ObjString *string) {
+    size_t mask = entries.size() - 1;
+    for (size_t i = string->hash & mask;; i = (i + 1) & mask) {
+        if (entries[i] == string) {
+            return i;
+        }
+        assert(entries[i] != nullptr);
+    }
+}
+
+void StringTable::remove(ObjString *string) {
+    entries[findSlot(string)] = TOMBSTONE;
+}
+
+void StringTable::grow() {
+    std::vector<ObjString*> old = std::move(entries);
+    size_t live = 0;
+    for (auto entry : old) {
+        if (entry != nullptr && entry != TOMBSTONE) live++;
+    }
+
+    size_t capacity = 16;
+    while (capacity < 4 * (live + 1)) capacity *= 2;
+    entries.assign(capacity, nullptr);
+    count = 0;
+    for (auto entry : old) {
+        if (entry != nullptr && entry != TOMBSTONE) {
+            insert(entry);
+        }
+    }
+}
+
+// FNV-1a
+uint32_t hashString(const std::string &chars) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : chars) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+StringTable &strings() {
+    // Never destroyed: strings may still be released during static destruction.
+    static StringTable *table = new StringTable();
+    return *table;
+}
+
+ObjString *intern(std::string chars) {
+    uint32_t hash = hashString(chars);
+    if (ObjString *string = strings().find(chars, hash); string) {
+        return string;
+    }
+    ObjString *string = heap().allocate<ObjString>(std::move(chars), hash);
+    strings().insert(string);
+    return string;
+}
+
+Names::Names() : init(intern("init")), thisName(intern("this")), super(intern("super")) {
+    heap().pin(init);
+    heap().pin(thisName);
+    heap().pin(super);
+}
+
+Names &names() {
+    static Names *names = new Names();
+    return *names;
+}
+
+// Results shorter than this are copied and interned right away.
+static const size_t MIN_ROPE_LENGTH = 64;
+
+ObjString *concatenate(ObjString *lhs, ObjString *rhs) {
+    if (lhs->length == 0) return rhs;
+    if (rhs->length == 0) return lhs;
+    if (lhs->length + rhs->length < MIN_ROPE_LENGTH) {
+        return intern(lhs->flatten() + rhs->flatten());
+    }
+    return heap().allocate<ObjString>(lhs, rhs);
+}
+
+ObjString::ObjString(ObjString *left, ObjString *right) :
+    Obj(ObjType::STRING), length(left->length + right->length), hash(0), interned(false), left(left), right(right) {}
+
+const std::string &ObjString::flatten() {
+    if (!isRope()) {
+        return chars;
+    }
+
+    chars.reserve(length);
+    std::vector<ObjString*> pending{this};
+    while (!pending.empty()) {
+        ObjString *node = pending.back();
+        pending.pop_back();
+        if (!node->isRope()) {
+            chars += node->chars;
+        } else {
+            pending.push_back(node->right);
+            pending.push_back(node->left);
+        }
+    }
+    left = right = nullptr;
+    heap().bytesAllocated += length;
+    return chars;
+}
+
+bool ObjString::equals(ObjString *other) {
+    if (this == other) return true;
+    if (interned && other->interned) return false;
+    if (length != other->length) return false;
+    return flatten() == other->flatten();
+}
+
+void ObjString::trace(Heap &heap) {
+    heap.markObject(left);
+    heap.markObject(right);
+}
+
+ObjString::~ObjString() {
+    if (interned) {
+        strings().remove(this);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "value.hpp"
+
+// Weak set of all flat strings. A string unregisters itself when it is
+// collected.
+struct StringTable {
+    std::vector<ObjString*> entries;
+    size_t count;
+
+    StringTable();
+
+    ObjString *find(const std::string &chars, uint32_t hash);
+    void insert(ObjString *string);
+    void remove(ObjString *string);
+
+private:
+    size_t findSlot(ObjString *string);
+    void grow();
+};
+
+// Names the runtime looks up by itself, interned once and pinned.
+struct Names {
+    ObjString *init;
+    ObjString *thisName;
+    ObjString *super;
+
+    Names();
+};
+
+uint32_t hashString(const std::string &chars);
+StringTable &strings();
+ObjString *intern(std::string chars);
+ObjString *concatenate(ObjString *lhs, ObjString *rhs);
+Names &names();
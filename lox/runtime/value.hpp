@@ -0,0 +1,178 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+struct Heap;
+
+enum class ObjType {
+    STRING,
+    FUNCTION,
+    BOUND_METHOD,
+    NATIVE,
+    CLASS,
+    INSTANCE,
+    ENVIRONMENT,
+    SHAPE,
+    VM_FUNCTION,
+    VM_UPVALUE,
+    VM_CLOSURE,
+    VM_NATIVE,
+    VM_CLASS,
+    VM_INSTANCE,
+    VM_BOUND_METHOD,
+    AOT_ENVIRONMENT,
+    AOT_FUNCTION,
+    AOT_NATIVE,
+    AOT_CLASS,
+    AOT_INSTANCE,
+    AOT_BOUND_METHOD
+};
+
+// Every heap allocated runtime object. Objects are created with
+// Heap::allocate and owned by the tracing collector.
+struct Obj {
+    ObjType type;
+    bool marked;
+    bool pinned;
+    Obj *next;
+
+    Obj(ObjType type) : type(type), marked(false), pinned(false), next(nullptr) {}
+    virtual ~Obj() = default;
+
+    virtual std::string toString() = 0;
+    // Approximate number of bytes owned by the object, used to pace collections.
+    virtual size_t size() const = 0;
+    // Marks every object directly referenced by this one.
+    virtual void trace(Heap &heap) {}
+};
+
+// Immutable string. Flat strings are created through intern(), so two of
+// them with the same contents are always the same object. Long
+// concatenations are ropes: the children are kept until the contents are
+// first needed, and then flattened once into chars.
+struct ObjString : Obj {
+    std::string chars;
+    size_t length;
+    uint32_t hash;
+    bool interned;
+    ObjString *left;
+    ObjString *right;
+
+    ObjString(std::string chars, uint32_t hash) : Obj(ObjType::STRING), chars(std::move(chars)), hash(hash), interned(true), left(nullptr), right(nullptr) {
+        length = this->chars.size();
+    }
+    ObjString(ObjString *left, ObjString *right);
+    ~ObjString() override;
+
+    bool isRope() const {
+        return left != nullptr;
+    }
+
+    const std::string &flatten();
+    bool equals(ObjString *other);
+
+    std::string toString() override {
+        return flatten();
+    }
+
+    size_t size() const override {
+        return sizeof(ObjString) + chars.size();
+    }
+
+    void trace(Heap &heap) override;
+};
+
+struct ObjStringHash {
+    size_t operator()(const ObjString *string) const {
+        return string->hash;
+    }
+};
+
+enum class ValueType {
+    NIL,
+    BOOL,
+    NUMBER,
+    OBJ
+};
+
+// 16 byte tagged value: nil, booleans and numbers live inline, everything
+// else is a pointer to a garbage collected Obj.
+struct Value {
+    ValueType type;
+    union {
+        bool boolean;
+        double number;
+        Obj *obj;
+    } as;
+
+    Value() : type(ValueType::NIL) { as.obj = nullptr; }
+    Value(std::nullptr_t) : Value() {}
+    Value(bool boolean) : type(ValueType::BOOL) { as.boolean = boolean; }
+    Value(double number) : type(ValueType::NUMBER) { as.number = number; }
+    Value(Obj *obj) : type(ValueType::OBJ) { as.obj = obj; }
+
+    bool isNil() const { return type == ValueType::NIL; }
+    bool isBool() const { return type == ValueType::BOOL; }
+    bool isNumber() const { return type == ValueType::NUMBER; }
+    bool isObj() const { return type == ValueType::OBJ; }
+    bool isObjType(ObjType objType) const { return isObj() && as.obj->type == objType; }
+    bool isString() const { return isObjType(ObjType::STRING); }
+    bool isClass() const { return isObjType(ObjType::CLASS); }
+    bool isInstance() const { return isObjType(ObjType::INSTANCE); }
+    bool isCallable() const {
+        return isObjType(ObjType::FUNCTION) || isObjType(ObjType::BOUND_METHOD) || isObjType(ObjType::NATIVE) || isObjType(ObjType::CLASS);
+    }
+
+    bool asBool() const { return as.boolean; }
+    double asNumber() const { return as.number; }
+    Obj *asObj() const { return as.obj; }
+    ObjString *asString() const { return static_cast<ObjString*>(as.obj); }
+
+    template <typename T>
+    T *asObj() const { return static_cast<T*>(as.obj); }
+};
+
+inline bool isTruthy(Value v) {
+    if (v.isNil()) return false;
+    if (v.isBool()) return v.asBool();
+    return true;
+}
+
+inline bool isEqual(Value lhs, Value rhs) {
+    if (lhs.type != rhs.type) return false;
+
+    switch (lhs.type) {
+        case ValueType::NIL:
+            return true;
+        case ValueType::BOOL:
+            return lhs.asBool() == rhs.asBool();
+        case ValueType::NUMBER:
+            return lhs.asNumber() == rhs.asNumber();
+        case ValueType::OBJ:
+            if (lhs.isString() && rhs.isString()) {
+                return lhs.asString()->equals(rhs.asString());
+            }
+            return lhs.asObj() == rhs.asObj();
+    }
+    assert(0);
+}
+
+inline std::string stringify(Value v) {
+    switch (v.type) {
+        case ValueType::NUMBER: {
+            auto d = v.asNumber();
+            if (int(d) == d) {
+                return std::to_string(int(d));
+            } else {
+                return std::to_string(d);
+            }
+        }
+        case ValueType::BOOL:
+            return v.asBool() ? "true" : "false";
+        case ValueType::NIL:
+            return "nil";
+        case ValueType::OBJ:
+            return v.asObj()->toString();
+    }
+    assert(0);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "../lexer/token.hpp"
+
+// Operands follow the opcode: u8 for local, upvalue and argument counts,
+// u16 (big endian) for constant and global indices and jump offsets.
+#define FOR_EACH_OPCODE(X) \
+    X(OP_CONSTANT)         \
+    X(OP_NIL)              \
+    X(OP_TRUE)             \
+    X(OP_FALSE)            \
+    X(OP_POP)              \
+    X(OP_GET_LOCAL)        \
+    X(OP_SET_LOCAL)        \
+    X(OP_GET_GLOBAL)       \
+    X(OP_DEFINE_GLOBAL)    \
+    X(OP_SET_GLOBAL)       \
+    X(OP_GET_UPVALUE)      \
+    X(OP_SET_UPVALUE)      \
+    X(OP_GET_PROPERTY)     \
+    X(OP_SET_PROPERTY)     \
+    X(OP_GET_SUPER)        \
+    X(OP_EQUAL)            \
+    X(OP_NOT_EQUAL)        \
+    X(OP_GREATER)          \
+    X(OP_GREATER_EQUAL)    \
+    X(OP_LESS)             \
+    X(OP_LESS_EQUAL)       \
+    X(OP_ADD)              \
+    X(OP_SUBTRACT)         \
+    X(OP_MULTIPLY)         \
+    X(OP_DIVIDE)           \
+    X(OP_NOT)              \
+    X(OP_NEGATE)           \
+    X(OP_PRINT)            \
+    X(OP_JUMP)             \
+    X(OP_JUMP_IF_FALSE)    \
+    X(OP_LOOP)             \
+    X(OP_CALL)             \
+    X(OP_INVOKE)           \
+    X(OP_SUPER_INVOKE)     \
+    X(OP_CLOSURE)          \
+    X(OP_CLOSE_UPVALUE)    \
+    X(OP_RETURN)           \
+    X(OP_CLASS)            \
+    X(OP_INHERIT)          \
+    X(OP_METHOD)
+
+enum OpCode : uint8_t {
+#define OPCODE_ENUM(name) name,
+    FOR_EACH_OPCODE(OPCODE_ENUM)
+#undef OPCODE_ENUM
+};
+
+struct Chunk {
+    std::vector<uint8_t> code;
+    std::vector<Value> constants;
+    // Token each byte was compiled from, as an index into tokens, so runtime
+    // errors are reported exactly like the tree-walker reports them.
+    std::vector<uint32_t> tokenIndices;
+    std::vector<Token> tokens;
+
+    void write(uint8_t byte, const Token &token) {
+        if (tokens.empty() || tokens.back().line != token.line || tokens.back().lexeme != token.lexeme) {
+            tokens.push_back(token);
+        }
+        code.push_back(byte);
+        tokenIndices.push_back(tokens.size() - 1);
+    }
+
+    int addConstant(Value value) {
+        for (int i = 0; i < int(constants.size()); i++) {
+            bool same = (value.isNumber() ? constants[i].isNumber() && constants[i].asNumber() == value.asNumber()
+                                          : constants[i].isObj() && constants[i].asObj() == value.asObj());
+            if (same) {
+                return i;
+            }
+        }
+        constants.push_back(value);
+        return constants.size() - 1;
+    }
+
+    const Token &tokenAt(size_t offset) const {
+        return tokens[tokenIndices[offset]];
+    }
+};
@@ -0,0 +1,656 @@
+#include "compiler.hpp"
+
+// Bytes of an instruction with its operands.
+static int instructionLength(const Chunk &chunk, int offset) {
+    switch (chunk.code[offset]) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+            return 2;
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_CLASS:
+        case OP_METHOD:
+            return 3;
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 4;
+        case OP_CLOSURE: {
+            int constant = (chunk.code[offset + 1] << 8) | chunk.code[offset + 2];
+            return 3 + 2 * chunk.constants[constant].asObj<VmFunction>()->upvalueCount;
+        }
+        default:
+            return 1;
+    }
+}
+
+// Change in the stack height after an instruction runs. A call leaves its
+// result where the callee was; the callee's own frame is reserved when it is called.
+static int stackEffect(const Chunk &chunk, int offset) {
+    switch (chunk.code[offset]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+            return 1;
+        case OP_CALL:
+            return -chunk.code[offset + 1];
+        case OP_INVOKE:
+            return -chunk.code[offset + 3];
+        case OP_SUPER_INVOKE:
+            return -chunk.code[offset + 3] - 1;
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_RETURN:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Follows every path through the function's bytecode to find how high its
+// stack gets, so a call can reserve the whole frame up front.
+static int maxSlots(VmFunction *function) {
+    const Chunk &chunk = function->chunk;
+    std::vector<int> heights(chunk.code.size(), -1);
+    std::vector<std::pair<int, int>> pending{{0, function->arity + 1}};
+    int highest = function->arity + 1;
+    while (!pending.empty()) {
+        auto [offset, height] = pending.back();
+        pending.pop_back();
+        while (offset < int(chunk.code.size()) && heights[offset] < 0) {
+            heights[offset] = height;
+            height += stackEffect(chunk, offset);
+            highest = std::max(highest, height);
+            uint8_t op = chunk.code[offset];
+            int next = offset + instructionLength(chunk, offset);
+            if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP) {
+                int jump = (chunk.code[offset + 1] << 8) | chunk.code[offset + 2];
+                int target = (op == OP_LOOP ? next - jump : next + jump);
+                if (op != OP_JUMP_IF_FALSE) {
+                    offset = target;
+                    continue;
+                }
+                pending.push_back({target, height});
+            } else if (op == OP_RETURN) {
+                break;
+            }
+            offset = next;
+        }
+    }
+    return highest;
+}
+
+Compiler::Compiler(GlobalTable &globals, ErrorHandler &errorHandler) : globals(globals), errorHandler(errorHandler), current(nullptr), token(nullptr) {}
+
+VmFunction *Compiler::compile(const std::vector<std::shared_ptr<Stmt>> &statements) {
+    // The script is pinned while it is compiled: nothing else refers to it yet.
+    FunctionState state{nullptr, heap().pin(heap().allocate<VmFunction>("")), FunctionType::SCRIPT, {}, {}, {}, 0};
+    state.locals.push_back({nullptr, 0, false});
+    current = &state;
+    Token start(TokenType::END_OF_FILE, "", nullptr, 1);
+    token = &start;
+
+    for (auto &statement : statements) {
+        compile(statement);
+    }
+    token = &start;
+    emitReturn();
+    state.function->maxSlots = maxSlots(state.function);
+
+    current = nullptr;
+    state.function->pinned = false;
+    return state.function;
+}
+
+void Compiler::compile(std::shared_ptr<Expr> expr) {
+    expr->accept(*this);
+}
+
+void Compiler::compile(std::shared_ptr<Stmt> stmt) {
+    stmt->accept(*this);
+}
+
+Chunk &Compiler::chunk() {
+    return current->function->chunk;
+}
+
+void Compiler::emit(uint8_t byte) {
+    chunk().write(byte, *token);
+}
+
+void Compiler::emit(uint8_t byte, const Token &at) {
+    token = &at;
+    emit(byte);
+}
+
+void Compiler::emitShort(int value) {
+    emit((value >> 8) & 0xff);
+    emit(value & 0xff);
+}
+
+int Compiler::makeConstant(Value value) {
+    int index = chunk().addConstant(value);
+    if (index > UINT16_MAX) {
+        errorHandler.error(*token, "Too many constants in one chunk.");
+        return 0;
+    }
+    return index;
+}
+
+void Compiler::emitConstant(Value value) {
+    emit(OP_CONSTANT);
+    emitShort(makeConstant(value));
+}
+
+// Emits a forward jump with a placeholder offset, returning where to patch it.
+int Compiler::emitJump(OpCode op) {
+    emit(op);
+    emitShort(0xffff);
+    return chunk().code.size() - 2;
+}
+
+void Compiler::patchJump(int offset) {
+    int jump = chunk().code.size() - offset - 2;
+    if (jump > UINT16_MAX) {
+        errorHandler.error(*token, "Too much code to jump over.");
+    }
+    chunk().code[offset] = (jump >> 8) & 0xff;
+    chunk().code[offset + 1] = jump & 0xff;
+}
+
+void Compiler::emitLoop(int start) {
+    emit(OP_LOOP);
+    int offset = chunk().code.size() - start + 2;
+    if (offset > UINT16_MAX) {
+        errorHandler.error(*token, "Loop body too large.");
+    }
+    emitShort(offset);
+}
+
+void Compiler::emitReturn() {
+    emit(OP_NIL);
+    emit(OP_RETURN);
+}
+
+void Compiler::beginScope() {
+    current->scopeDepth++;
+}
+
+void Compiler::endScope() {
+    current->scopeDepth--;
+    discardLocals(current->scopeDepth);
+    while (!current->locals.empty() && current->locals.back().depth > current->scopeDepth) {
+        current->locals.pop_back();
+    }
+}
+
+// Pops the locals deeper than depth off the stack without forgetting them,
+// closing the captured ones.
+void Compiler::discardLocals(int depth) {
+    for (int i = current->locals.size() - 1; i >= 0 && current->locals[i].depth > depth; i--) {
+        emit(current->locals[i].captured ? OP_CLOSE_UPVALUE : OP_POP);
+    }
+}
+
+void Compiler::addLocal(ObjString *name) {
+    if (current->locals.size() > UINT8_MAX) {
+        errorHandler.error(*token, "Too many local variables in function.");
+        return;
+    }
+    current->locals.push_back({name, current->scopeDepth, false});
+}
+
+int Compiler::resolveLocal(FunctionState *state, ObjString *name) {
+    for (int i = state->locals.size() - 1; i >= 0; i--) {
+        if (state->locals[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int Compiler::resolveUpvalue(FunctionState *state, ObjString *name) {
+    if (state->enclosing == nullptr) {
+        return -1;
+    }
+    if (int local = resolveLocal(state->enclosing, name); local >= 0) {
+        state->enclosing->locals[local].captured = true;
+        return addUpvalue(state, local, true);
+    }
+    if (int upvalue = resolveUpvalue(state->enclosing, name); upvalue >= 0) {
+        return addUpvalue(state, upvalue, false);
+    }
+    return -1;
+}
+
+int Compiler::addUpvalue(FunctionState *state, uint8_t index, bool isLocal) {
+    auto &upvalues = state->upvalues;
+    for (int i = 0; i < int(upvalues.size()); i++) {
+        if (upvalues[i].index == index && upvalues[i].isLocal == isLocal) {
+            return i;
+        }
+    }
+    if (upvalues.size() > UINT8_MAX) {
+        errorHandler.error(*token, "Too many closure variables in function.");
+        return 0;
+    }
+    upvalues.push_back({index, isLocal});
+    state->function->upvalueCount = upvalues.size();
+    return upvalues.size() - 1;
+}
+
+// Names the resolver left unresolved as locals are globals, in the slot it assigned.
+void Compiler::getVariable(ObjString *name, const Token &at, int global) {
+    token = &at;
+    if (int local = resolveLocal(current, name); local >= 0) {
+        emit(OP_GET_LOCAL);
+        emit(local);
+    } else if (int upvalue = resolveUpvalue(current, name); upvalue >= 0) {
+        emit(OP_GET_UPVALUE);
+        emit(upvalue);
+    } else {
+        emit(OP_GET_GLOBAL);
+        emitShort(global);
+    }
+}
+
+void Compiler::setVariable(const Token &name, int global) {
+    token = &name;
+    if (int local = resolveLocal(current, name.identifier()); local >= 0) {
+        emit(OP_SET_LOCAL);
+        emit(local);
+    } else if (int upvalue = resolveUpvalue(current, name.identifier()); upvalue >= 0) {
+        emit(OP_SET_UPVALUE);
+        emit(upvalue);
+    } else {
+        emit(OP_SET_GLOBAL);
+        emitShort(global);
+    }
+}
+
+// The value on top of the stack becomes the variable: a new local takes its
+// stack slot, a global is stored and popped.
+void Compiler::defineVariable(const Token &name) {
+    token = &name;
+    if (current->scopeDepth > 0) {
+        addLocal(name.identifier());
+    } else {
+        emit(OP_DEFINE_GLOBAL);
+        emitShort(globals.slot(name.identifier()));
+    }
+}
+
+void Compiler::compileFunction(std::shared_ptr<FunctionStmt> stmt, FunctionType type) {
+    FunctionState state{current, heap().pin(heap().allocate<VmFunction>(stmt->name.lexeme)), type, {}, {}, {}, 0};
+    state.function->arity = stmt->parameters.size();
+    // Slot 0 holds the receiver of a method and the callee of a function.
+    state.locals.push_back({type == FunctionType::FUNCTION ? nullptr : names().thisName, 0, false});
+    current = &state;
+
+    beginScope();
+    for (auto &parameter : stmt->parameters) {
+        token = &parameter;
+        addLocal(parameter.identifier());
+    }
+    for (auto &statement : stmt->body) {
+        compile(statement);
+    }
+    token = &stmt->name;
+    emitReturn();
+    state.function->maxSlots = maxSlots(state.function);
+
+    current = state.enclosing;
+    token = &stmt->name;
+    emit(OP_CLOSURE);
+    emitShort(makeConstant(state.function));
+    for (auto &upvalue : state.upvalues) {
+        emit(upvalue.isLocal ? 1 : 0);
+        emit(upvalue.index);
+    }
+    state.function->pinned = false;
+}
+
+void Compiler::visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) {
+    Value value = expr->value;
+    if (value.isNil()) {
+        emit(OP_NIL);
+    } else if (value.isBool()) {
+        emit(value.asBool() ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(value);
+    }
+}
+
+void Compiler::visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) {
+    compile(expr->expr);
+}
+
+void Compiler::visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) {
+    compile(expr->lhs);
+    compile(expr->rhs);
+
+    token = &expr->op;
+    switch (expr->op.type) {
+        case TokenType::BANG_EQUAL: emit(OP_NOT_EQUAL); break;
+        case TokenType::EQUAL_EQUAL: emit(OP_EQUAL); break;
+        case TokenType::GREATER: emit(OP_GREATER); break;
+        case TokenType::GREATER_EQUAL: emit(OP_GREATER_EQUAL); break;
+        case TokenType::LESS: emit(OP_LESS); break;
+        case TokenType::LESS_EQUAL: emit(OP_LESS_EQUAL); break;
+        case TokenType::PLUS: emit(OP_ADD); break;
+        case TokenType::MINUS: emit(OP_SUBTRACT); break;
+        case TokenType::STAR: emit(OP_MULTIPLY); break;
+        case TokenType::SLASH: emit(OP_DIVIDE); break;
+        default:
+            std::cerr << "Compiler internal error: unknown binary operator\n";
+            exit(1);
+    }
+}
+
+void Compiler::visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) {
+    compile(expr->lhs);
+    token = &expr->op;
+    if (expr->op.type == TokenType::OR) {
+        int elseJump = emitJump(OP_JUMP_IF_FALSE);
+        int endJump = emitJump(OP_JUMP);
+        patchJump(elseJump);
+        emit(OP_POP);
+        compile(expr->rhs);
+        patchJump(endJump);
+    } else {
+        int endJump = emitJump(OP_JUMP_IF_FALSE);
+        emit(OP_POP);
+        compile(expr->rhs);
+        patchJump(endJump);
+    }
+}
+
+void Compiler::visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) {
+    compile(expr->expr);
+    token = &expr->op;
+    emit(expr->op.type == TokenType::MINUS ? OP_NEGATE : OP_NOT);
+}
+
+void Compiler::visitVariableExpr(std::shared_ptr<VariableExpr> expr) {
+    getVariable(expr->name.identifier(), expr->name, expr->global);
+}
+
+void Compiler::visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) {
+    compile(expr->expr);
+    setVariable(expr->name, expr->global);
+}
+
+void Compiler::visitCallExpr(std::shared_ptr<CallExpr> expr) {
+    // A method call looks the method up and calls it in one instruction,
+    // without creating a bound method. The opcode is attributed to the
+    // parenthesis, the method name operand to the name.
+    if (auto get = std::dynamic_pointer_cast<GetExpr>(expr->callee); get) {
+        compile(get->object);
+        for (auto &argument : expr->arguments) {
+            compile(argument);
+        }
+        emit(OP_INVOKE, expr->paren);
+        token = &get->name;
+        emitShort(makeConstant(get->name.identifier()));
+        emit(expr->arguments.size(), expr->paren);
+    } else if (auto super = std::dynamic_pointer_cast<SuperExpr>(expr->callee); super) {
+        // The superclass is pushed after the arguments, above the receiver.
+        if (!hasSuper(super->keyword)) {
+            return;
+        }
+        getVariable(names().thisName, super->keyword, -1);
+        for (auto &argument : expr->arguments) {
+            compile(argument);
+        }
+        getVariable(names().super, super->keyword, -1);
+        emit(OP_SUPER_INVOKE, expr->paren);
+        token = &super->method;
+        emitShort(makeConstant(super->method.identifier()));
+        emit(expr->arguments.size(), expr->paren);
+    } else {
+        compile(expr->callee);
+        for (auto &argument : expr->arguments) {
+            compile(argument);
+        }
+        emit(OP_CALL, expr->paren);
+        emit(expr->arguments.size());
+    }
+}
+
+void Compiler::visitGetExpr(std::shared_ptr<GetExpr> expr) {
+    compile(expr->object);
+    emit(OP_GET_PROPERTY, expr->name);
+    emitShort(makeConstant(expr->name.identifier()));
+}
+
+void Compiler::visitSetExpr(std::shared_ptr<SetExpr> expr) {
+    compile(expr->object);
+    compile(expr->value);
+    emit(OP_SET_PROPERTY, expr->name);
+    emitShort(makeConstant(expr->name.identifier()));
+}
+
+// Outside of a class 'this' is looked up as a global that is never defined,
+// which fails at runtime like in the tree-walker.
+void Compiler::visitThisExpr(std::shared_ptr<ThisExpr> expr) {
+    getVariable(names().thisName, expr->keyword, globals.slot(names().thisName));
+}
+
+bool Compiler::hasSuper(const Token &keyword) {
+    if (resolveLocal(current, names().super) < 0 && resolveUpvalue(current, names().super) < 0) {
+        errorHandler.error(keyword, "'super' not in the subclass.");
+        return false;
+    }
+    return true;
+}
+
+void Compiler::visitSuperExpr(std::shared_ptr<SuperExpr> expr) {
+    if (hasSuper(expr->keyword)) {
+        getVariable(names().thisName, expr->keyword, -1);
+        getVariable(names().super, expr->keyword, -1);
+        emit(OP_GET_SUPER, expr->method);
+        emitShort(makeConstant(expr->method.identifier()));
+    }
+}
+
+// Leaves the innermost loop: the locals declared inside it are popped first.
+void Compiler::visitBreakStmt(std::shared_ptr<BreakStmt> stmt) {
+    token = &stmt->keyword;
+    if (current->loops.empty()) {
+        errorHandler.error(stmt->keyword, current->type == FunctionType::SCRIPT ? "Break statement at the top level." : "Break statement at the function level.");
+        return;
+    }
+    discardLocals(current->loops.back().scopeDepth);
+    int jump = emitJump(OP_JUMP);
+    current->loops.back().breakJumps.push_back(jump);
+}
+
+void Compiler::visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) {
+    token = &stmt->keyword;
+    if (current->loops.empty()) {
+        errorHandler.error(stmt->keyword, current->type == FunctionType::SCRIPT ? "Continue statement at the top level." : "Continue statement at the function level.");
+        return;
+    }
+    discardLocals(current->loops.back().scopeDepth);
+    if (int target = current->loops.back().continueTarget; target >= 0) {
+        emitLoop(target);
+    } else {
+        int jump = emitJump(OP_JUMP);
+        current->loops.back().continueJumps.push_back(jump);
+    }
+}
+
+void Compiler::visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) {
+    compile(stmt->expr);
+    emit(OP_POP);
+}
+
+void Compiler::visitPrintStmt(std::shared_ptr<PrintStmt> stmt) {
+    compile(stmt->expr);
+    emit(OP_PRINT);
+}
+
+void Compiler::visitVarStmt(std::shared_ptr<VarStmt> stmt) {
+    if (stmt->initializer != nullptr) {
+        compile(stmt->initializer);
+    } else {
+        emit(OP_NIL, stmt->name);
+    }
+    defineVariable(stmt->name);
+}
+
+void Compiler::visitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+    beginScope();
+    for (auto &statement : stmt->statements) {
+        compile(statement);
+    }
+    endScope();
+}
+
+void Compiler::visitIfStmt(std::shared_ptr<IfStmt> stmt) {
+    compile(stmt->guard);
+    int elseJump = emitJump(OP_JUMP_IF_FALSE);
+    emit(OP_POP);
+    compile(stmt->then);
+    int endJump = emitJump(OP_JUMP);
+    patchJump(elseJump);
+    emit(OP_POP);
+    if (stmt->elsee != nullptr) {
+        compile(stmt->elsee);
+    }
+    patchJump(endJump);
+}
+
+void Compiler::visitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+    int loopStart = chunk().code.size();
+    compile(stmt->cond);
+    int exitJump = emitJump(OP_JUMP_IF_FALSE);
+    emit(OP_POP);
+
+    current->loops.push_back({current->scopeDepth, loopStart, {}, {}});
+    compile(stmt->body);
+    emitLoop(loopStart);
+
+    patchJump(exitJump);
+    emit(OP_POP);
+    for (int jump : current->loops.back().breakJumps) {
+        patchJump(jump);
+    }
+    current->loops.pop_back();
+}
+
+// The loop variable is a local of its own scope. A continue jumps forward
+// to the increment, which only follows the body.
+void Compiler::visitForStmt(std::shared_ptr<ForStmt> stmt) {
+    beginScope();
+    if (stmt->initializer) {
+        compile(stmt->initializer);
+    }
+
+    int loopStart = chunk().code.size();
+    int exitJump = -1;
+    if (stmt->cond) {
+        compile(stmt->cond);
+        exitJump = emitJump(OP_JUMP_IF_FALSE);
+        emit(OP_POP);
+    }
+
+    current->loops.push_back({current->scopeDepth, -1, {}, {}});
+    compile(stmt->body);
+    current->loops.back().continueTarget = chunk().code.size();
+    for (int jump : current->loops.back().continueJumps) {
+        patchJump(jump);
+    }
+    if (stmt->increment) {
+        compile(stmt->increment);
+        emit(OP_POP);
+    }
+    emitLoop(loopStart);
+
+    if (exitJump >= 0) {
+        patchJump(exitJump);
+        emit(OP_POP);
+    }
+    for (int jump : current->loops.back().breakJumps) {
+        patchJump(jump);
+    }
+    current->loops.pop_back();
+    endScope();
+}
+
+void Compiler::visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+    if (current->scopeDepth > 0) {
+        // Declared before the body is compiled, so the body can refer to it.
+        token = &stmt->name;
+        addLocal(stmt->name.identifier());
+        compileFunction(stmt, FunctionType::FUNCTION);
+    } else {
+        compileFunction(stmt, FunctionType::FUNCTION);
+        defineVariable(stmt->name);
+    }
+}
+
+void Compiler::visitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+    int global = (current->scopeDepth > 0 ? -1 : globals.slot(stmt->name.identifier()));
+    emit(OP_CLASS, stmt->name);
+    emitShort(makeConstant(stmt->name.identifier()));
+    defineVariable(stmt->name);
+
+    if (stmt->superclass) {
+        // The superclass stays on the stack as the local 'super' while the methods are created.
+        compile(stmt->superclass);
+        beginScope();
+        addLocal(names().super);
+        getVariable(stmt->name.identifier(), stmt->name, global);
+        emit(OP_INHERIT, stmt->superclass->name);
+    }
+
+    getVariable(stmt->name.identifier(), stmt->name, global);
+    for (auto &method : stmt->methods) {
+        compileFunction(method, FunctionType::METHOD);
+        emit(OP_METHOD, method->name);
+        emitShort(makeConstant(method->name.identifier()));
+    }
+    emit(OP_POP);
+
+    if (stmt->superclass) {
+        endScope();
+    }
+}
+
+void Compiler::visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+    token = &stmt->keyword;
+    if (current->type == FunctionType::SCRIPT) {
+        errorHandler.error(stmt->keyword, "Return statement at the top level.");
+        return;
+    }
+    if (stmt->expr == nullptr) {
+        emitReturn();
+        return;
+    }
+    compile(stmt->expr);
+    emit(OP_RETURN, stmt->keyword);
+}
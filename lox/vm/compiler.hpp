@@ -0,0 +1,110 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "objects.hpp"
+#include "../ast/ast.hpp"
+#include "../error/error_handler.hpp"
+#include "../interpreter/globals.hpp"
+
+enum class FunctionType {
+    SCRIPT,
+    FUNCTION,
+    METHOD
+};
+
+// Compiles a resolved AST into bytecode for the VM. Locals live in stack
+// slots assigned here; globals use the slots the resolver assigned.
+struct Compiler : VisitorExpr, VisitorStmt {
+    struct Local {
+        ObjString *name;
+        int depth;
+        bool captured;
+    };
+
+    struct Upvalue {
+        uint8_t index;
+        bool isLocal;
+    };
+
+    struct Loop {
+        int scopeDepth;
+        // Where continue jumps to, or -1 while it is not known yet.
+        int continueTarget;
+        std::vector<int> breakJumps;
+        std::vector<int> continueJumps;
+    };
+
+    struct FunctionState {
+        FunctionState *enclosing;
+        VmFunction *function;
+        FunctionType type;
+        std::vector<Local> locals;
+        std::vector<Upvalue> upvalues;
+        std::vector<Loop> loops;
+        int scopeDepth;
+    };
+
+    GlobalTable &globals;
+    ErrorHandler &errorHandler;
+    FunctionState *current;
+    // Token the next emitted bytes are attributed to.
+    const Token *token;
+
+    Compiler(GlobalTable &globals, ErrorHandler &errorHandler);
+
+    VmFunction *compile(const std::vector<std::shared_ptr<Stmt>> &statements);
+
+    void compile(std::shared_ptr<Expr> expr);
+    void compile(std::shared_ptr<Stmt> stmt);
+    void compileFunction(std::shared_ptr<FunctionStmt> stmt, FunctionType type);
+
+    Chunk &chunk();
+    void emit(uint8_t byte);
+    void emit(uint8_t byte, const Token &at);
+    void emitShort(int value);
+    void emitConstant(Value value);
+    int makeConstant(Value value);
+    int emitJump(OpCode op);
+    void patchJump(int offset);
+    void emitLoop(int start);
+    void emitReturn();
+
+    void beginScope();
+    void endScope();
+    void discardLocals(int depth);
+    void addLocal(ObjString *name);
+    int resolveLocal(FunctionState *state, ObjString *name);
+    int resolveUpvalue(FunctionState *state, ObjString *name);
+    int addUpvalue(FunctionState *state, uint8_t index, bool isLocal);
+    void getVariable(ObjString *name, const Token &at, int global);
+    void setVariable(const Token &name, int global);
+    void defineVariable(const Token &name);
+    bool hasSuper(const Token &keyword);
+
+    void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override;
+    void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override;
+    void visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) override;
+    void visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) override;
+    void visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) override;
+    void visitVariableExpr(std::shared_ptr<VariableExpr> expr) override;
+    void visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) override;
+    void visitCallExpr(std::shared_ptr<CallExpr> expr) override;
+    void visitGetExpr(std::shared_ptr<GetExpr> expr) override;
+    void visitSetExpr(std::shared_ptr<SetExpr> expr) override;
+    void visitThisExpr(std::shared_ptr<ThisExpr> expr) override;
+    void visitSuperExpr(std::shared_ptr<SuperExpr> expr) override;
+
+    void visitBreakStmt(std::shared_ptr<BreakStmt> expr) override;
+    void visitContinueStmt(std::shared_ptr<ContinueStmt> expr) override;
+    void visitExpressionStmt(std::shared_ptr<ExpressionStmt> expr) override;
+    void visitPrintStmt(std::shared_ptr<PrintStmt> expr) override;
+    void visitVarStmt(std::shared_ptr<VarStmt> expr) override;
+    void visitBlockStmt(std::shared_ptr<BlockStmt>) override;
+    void visitIfStmt(std::shared_ptr<IfStmt>) override;
+    void visitWhileStmt(std::shared_ptr<WhileStmt>) override;
+    void visitForStmt(std::shared_ptr<ForStmt>) override;
+    void visitFunctionStmt(std::shared_ptr<FunctionStmt>) override;
+    void visitClassStmt(std::shared_ptr<ClassStmt>) override;
+    void visitReturnStmt(std::shared_ptr<ReturnStmt>) override;
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "chunk.hpp"
+#include "../runtime/heap.hpp"
+#include "../runtime/shape.hpp"
+
+// Runtime objects of the bytecode VM. They share values, strings, shapes
+// and the collector with the tree-walker, but not its callables, which
+// execute AST nodes.
+
+struct VmFunction : Obj {
+    int arity;
+    int upvalueCount;
+    // Most slots a frame of the function uses, counting from its callee slot.
+    int maxSlots;
+    Chunk chunk;
+    std::string name;
+
+    VmFunction(std::string name) : Obj(ObjType::VM_FUNCTION), arity(0), upvalueCount(0), maxSlots(1), name(name) {}
+
+    std::string toString() override {
+        return name.empty() ? "<script>" : "<fn " + name + ">";
+    }
+
+    size_t size() const override {
+        return sizeof(VmFunction) + chunk.code.size() * (1 + sizeof(uint32_t)) + chunk.constants.size() * sizeof(Value);
+    }
+
+    void trace(Heap &heap) override {
+        for (auto &constant : chunk.constants) {
+            heap.markValue(constant);
+        }
+    }
+};
+
+// A variable captured by a closure. While the variable's frame is active,
+// location points into the VM stack; when the frame returns the value is
+// moved into closed.
+struct VmUpvalue : Obj {
+    Value *location;
+    Value closed;
+    VmUpvalue *nextOpen;
+
+    VmUpvalue(Value *location) : Obj(ObjType::VM_UPVALUE), location(location), nextOpen(nullptr) {}
+
+    std::string toString() override {
+        return "<upvalue>";
+    }
+
+    size_t size() const override {
+        return sizeof(VmUpvalue);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markValue(closed);
+    }
+};
+
+struct VmClosure : Obj {
+    VmFunction *function;
+    std::vector<VmUpvalue*> upvalues;
+
+    VmClosure(VmFunction *function) : Obj(ObjType::VM_CLOSURE), function(function), upvalues(function->upvalueCount, nullptr) {}
+
+    std::string toString() override {
+        return function->toString();
+    }
+
+    size_t size() const override {
+        return sizeof(VmClosure) + upvalues.size() * sizeof(VmUpvalue*);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(function);
+        for (auto upvalue : upvalues) {
+            heap.markObject(upvalue);
+        }
+    }
+};
+
+typedef Value (*NativeFn)(int argCount, Value *args);
+
+struct VmNative : Obj {
+    std::string name;
+    int arity;
+    NativeFn function;
+
+    VmNative(std::string name, int arity, NativeFn function) : Obj(ObjType::VM_NATIVE), name(name), arity(arity), function(function) {}
+
+    std::string toString() override {
+        return "<native " + name + " fn>";
+    }
+
+    size_t size() const override {
+        return sizeof(VmNative);
+    }
+};
+
+struct VmClass : Obj {
+    std::string name;
+    // Own and inherited methods; OP_INHERIT copies the superclass's table down.
+    std::unordered_map<ObjString*, VmClosure*, ObjStringHash> methods;
+    VmClosure *initializer;
+    Shape *rootShape;
+
+    VmClass(std::string name) : Obj(ObjType::VM_CLASS), name(name), initializer(nullptr) {
+        rootShape = heap().allocate<Shape>(nullptr, nullptr);
+    }
+
+    VmClosure *findMethod(ObjString *name) {
+        auto it = methods.find(name);
+        return it != methods.end() ? it->second : nullptr;
+    }
+
+    std::string toString() override {
+        return "<class " + name + ">";
+    }
+
+    size_t size() const override {
+        return sizeof(VmClass) + methods.size() * sizeof(std::pair<ObjString*, VmClosure*>);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(rootShape);
+        heap.markObject(initializer);
+        for (auto &[methodName, method] : methods) {
+            heap.markObject(methodName);
+            heap.markObject(method);
+        }
+    }
+};
+
+// Fields are stored by the index their shape assigns.
+struct VmInstance : Obj {
+    VmClass *klass;
+    Shape *shape;
+    std::vector<Value> fields;
+
+    VmInstance(VmClass *klass) : Obj(ObjType::VM_INSTANCE), klass(klass), shape(klass->rootShape) {}
+
+    void set(ObjString *name, Value value) {
+        int index = shape->lookup(name);
+        if (index < 0) {
+            shape = shape->transition(name);
+            fields.push_back(value);
+            heap().bytesAllocated += sizeof(Value);
+        } else {
+            fields[index] = value;
+        }
+    }
+
+    std::string toString() override {
+        return "<" + klass->name + " object>";
+    }
+
+    size_t size() const override {
+        return sizeof(VmInstance) + fields.capacity() * sizeof(Value);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markObject(klass);
+        heap.markObject(shape);
+        for (auto &field : fields) {
+            heap.markValue(field);
+        }
+    }
+};
+
+struct VmBoundMethod : Obj {
+    Value receiver;
+    VmClosure *method;
+
+    VmBoundMethod(Value receiver, VmClosure *method) : Obj(ObjType::VM_BOUND_METHOD), receiver(receiver), method(method) {}
+
+    std::string toString() override {
+        return method->toString();
+    }
+
+    size_t size() const override {
+        return sizeof(VmBoundMethod);
+    }
+
+    void trace(Heap &heap) override {
+        heap.markValue(receiver);
+        heap.markObject(method);
+    }
+};
@@ -0,0 +1,494 @@
+#include "vm.hpp"
+
+static Value clockNative(int argCount, Value *args) {
+    return double(time(0));
+}
+
+VM::VM(ErrorHandler &errorHandler) : errorHandler(errorHandler), stackCapacity(INITIAL_SLOTS), stackLimit(64 << 20), openUpvalues(nullptr) {
+    // Left uninitialized: only the slots below stackTop are ever read.
+    stack = static_cast<Value*>(::operator new(stackCapacity * sizeof(Value)));
+    stackTop = stack;
+    heap().addRoots(this);
+
+    defineNative("clock", 0, clockNative);
+}
+
+VM::~VM() {
+    heap().removeRoots(this);
+    ::operator delete(stack);
+}
+
+void VM::markRoots(Heap &heap) {
+    globals.trace(heap);
+    for (Value *slot = stack; slot < stackTop; slot++) {
+        heap.markValue(*slot);
+    }
+    for (auto &frame : frames) {
+        heap.markObject(frame.closure);
+    }
+    for (VmUpvalue *upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+        heap.markObject(upvalue);
+    }
+}
+
+void VM::defineNative(std::string name, int arity, NativeFn function) {
+    globals.define(heap().pin(intern(name)), heap().allocate<VmNative>(name, arity, function));
+}
+
+void VM::interpret(VmFunction *script) {
+    push(script);
+    VmClosure *closure = heap().allocate<VmClosure>(script);
+    stackTop[-1] = closure;
+    frames.push_back({closure, closure->function->chunk.code.data(), 0, false});
+    if (size_t(script->maxSlots) > stackCapacity) {
+        growStack(script->maxSlots);
+    }
+
+    try {
+        run();
+    } catch (RunTimeError &e) {
+        errorHandler.error(e);
+    }
+    // After an error, closures that outlive the aborted frames keep their values.
+    closeUpvalues(stack);
+    stackTop = stack;
+    frames.clear();
+}
+
+void VM::callValue(Value callee, int argCount, const Token &paren) {
+    if (callee.isObj()) {
+        switch (callee.asObj()->type) {
+            case ObjType::VM_CLOSURE:
+                call(callee.asObj<VmClosure>(), argCount, paren);
+                return;
+            case ObjType::VM_NATIVE: {
+                auto native = callee.asObj<VmNative>();
+                if (native->arity != argCount) {
+                    throw RunTimeError(paren, "Expected " + std::to_string(native->arity) + " parameters, but got " + std::to_string(argCount) + "arguments.");
+                }
+                Value result = native->function(argCount, stackTop - argCount);
+                stackTop -= argCount + 1;
+                push(result);
+                return;
+            }
+            case ObjType::VM_CLASS: {
+                auto klass = callee.asObj<VmClass>();
+                stackTop[-argCount - 1] = heap().allocate<VmInstance>(klass);
+                if (klass->initializer) {
+                    call(klass->initializer, argCount, paren, true);
+                } else if (argCount != 0) {
+                    throw RunTimeError(paren, "Expected 0 parameters, but got " + std::to_string(argCount) + "arguments.");
+                }
+                return;
+            }
+            case ObjType::VM_BOUND_METHOD: {
+                auto bound = callee.asObj<VmBoundMethod>();
+                stackTop[-argCount - 1] = bound->receiver;
+                call(bound->method, argCount, paren);
+                return;
+            }
+            default:
+                break;
+        }
+    }
+    throw RunTimeError(paren, "Can only call functions and classes.");
+}
+
+void VM::call(VmClosure *closure, int argCount, const Token &paren, bool constructing) {
+    if (argCount != closure->function->arity) {
+        throw RunTimeError(paren, "Expected " + std::to_string(closure->function->arity) + " parameters, but got " + std::to_string(argCount) + "arguments.");
+    }
+    size_t base = size_t(stackTop - stack) - argCount - 1;
+    reserveFrame(base + closure->function->maxSlots, paren);
+    frames.push_back({closure, closure->function->chunk.code.data(), base, constructing});
+}
+
+// Makes room for a frame whose slots end at needed, growing the stacks up
+// to the limit. Frames refer to their slots by index, so only open upvalues
+// need moving.
+void VM::reserveFrame(size_t needed, const Token &paren) {
+    if (needed * sizeof(Value) + (frames.size() + 1) * sizeof(CallFrame) > stackLimit) {
+        throw RunTimeError(paren, "Stack overflow.");
+    }
+    if (needed > stackCapacity) {
+        growStack(std::max(needed, 2 * stackCapacity));
+    }
+}
+
+void VM::growStack(size_t capacity) {
+    Value *grown = static_cast<Value*>(::operator new(capacity * sizeof(Value)));
+    std::copy(stack, stackTop, grown);
+    for (VmUpvalue *upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+        upvalue->location = grown + (upvalue->location - stack);
+    }
+    stackTop = grown + (stackTop - stack);
+    ::operator delete(stack);
+    stack = grown;
+    stackCapacity = capacity;
+}
+
+void VM::invoke(ObjString *name, int argCount, const Token &nameToken, const Token &paren) {
+    Value receiver = peek(argCount);
+    if (!receiver.isObjType(ObjType::VM_INSTANCE)) {
+        throw RunTimeError(nameToken, "Only instances have properties.");
+    }
+    auto instance = receiver.asObj<VmInstance>();
+    // Fields shadow methods.
+    if (int index = instance->shape->lookup(name); index >= 0) {
+        Value field = instance->fields[index];
+        stackTop[-argCount - 1] = field;
+        callValue(field, argCount, paren);
+        return;
+    }
+    VmClosure *method = instance->klass->findMethod(name);
+    if (!method) {
+        throw RunTimeError(nameToken, "Undefined property '" + nameToken.lexeme + "'.");
+    }
+    call(method, argCount, paren);
+}
+
+VmUpvalue *VM::captureUpvalue(Value *local) {
+    VmUpvalue *previous = nullptr;
+    VmUpvalue *upvalue = openUpvalues;
+    while (upvalue != nullptr && upvalue->location > local) {
+        previous = upvalue;
+        upvalue = upvalue->nextOpen;
+    }
+    if (upvalue != nullptr && upvalue->location == local) {
+        return upvalue;
+    }
+
+    VmUpvalue *created = heap().allocate<VmUpvalue>(local);
+    created->nextOpen = upvalue;
+    if (previous == nullptr) {
+        openUpvalues = created;
+    } else {
+        previous->nextOpen = created;
+    }
+    return created;
+}
+
+void VM::closeUpvalues(Value *last) {
+    while (openUpvalues != nullptr && openUpvalues->location >= last) {
+        VmUpvalue *upvalue = openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        openUpvalues = upvalue->nextOpen;
+    }
+}
+
+void VM::run() {
+    CallFrame *frame = &frames.back();
+    uint8_t *ip = frame->ip;
+    Value *slots = stack + frame->base;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, uint16_t((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (frame->closure->function->chunk.constants[READ_SHORT()])
+#define READ_STRING() (READ_CONSTANT().asString())
+// Token of the byte n bytes before ip.
+#define TOKEN(n) (frame->closure->function->chunk.tokenAt(ip - frame->closure->function->chunk.code.data() - (n)))
+// Calls and returns switch frames; ip lives in a local in between.
+#define SAVE_FRAME() (frame->ip = ip)
+#define LOAD_FRAME() (frame = &frames.back(), ip = frame->ip, slots = stack + frame->base)
+#define BINARY_NUMBER_OP(op)                                                \
+    do {                                                                    \
+        if (!stackTop[-1].isNumber() || !stackTop[-2].isNumber()) {         \
+            throw RunTimeError(TOKEN(1), "Operands must be numbers.");      \
+        }                                                                   \
+        double rhs = pop().asNumber();                                      \
+        stackTop[-1] = Value(stackTop[-1].asNumber() op rhs);               \
+    } while (false)
+
+#if defined(__GNUC__)
+    // Threaded dispatch: every instruction jumps straight to the next one's handler.
+#define OPCODE_LABEL(name) &&LABEL_##name,
+    static void *dispatchTable[] = {FOR_EACH_OPCODE(OPCODE_LABEL)};
+#undef OPCODE_LABEL
+#define DISPATCH() goto *dispatchTable[READ_BYTE()]
+#define CASE(name) LABEL_##name
+    DISPATCH();
+#else
+#define DISPATCH() break
+#define CASE(name) case name
+    for (;;) switch (READ_BYTE()) {
+#endif
+
+    CASE(OP_CONSTANT): {
+        push(READ_CONSTANT());
+        DISPATCH();
+    }
+    CASE(OP_NIL): {
+        push(nullptr);
+        DISPATCH();
+    }
+    CASE(OP_TRUE): {
+        push(true);
+        DISPATCH();
+    }
+    CASE(OP_FALSE): {
+        push(false);
+        DISPATCH();
+    }
+    CASE(OP_POP): {
+        stackTop--;
+        DISPATCH();
+    }
+    CASE(OP_GET_LOCAL): {
+        push(slots[READ_BYTE()]);
+        DISPATCH();
+    }
+    CASE(OP_SET_LOCAL): {
+        slots[READ_BYTE()] = peek(0);
+        DISPATCH();
+    }
+    CASE(OP_GET_GLOBAL): {
+        int slot = READ_SHORT();
+        push(globals.get(slot, TOKEN(3)));
+        DISPATCH();
+    }
+    CASE(OP_DEFINE_GLOBAL): {
+        int slot = READ_SHORT();
+        globals.define(globals.names[slot], peek(0));
+        stackTop--;
+        DISPATCH();
+    }
+    CASE(OP_SET_GLOBAL): {
+        int slot = READ_SHORT();
+        globals.update(slot, TOKEN(3), peek(0));
+        DISPATCH();
+    }
+    CASE(OP_GET_UPVALUE): {
+        push(*frame->closure->upvalues[READ_BYTE()]->location);
+        DISPATCH();
+    }
+    CASE(OP_SET_UPVALUE): {
+        *frame->closure->upvalues[READ_BYTE()]->location = peek(0);
+        DISPATCH();
+    }
+    CASE(OP_GET_PROPERTY): {
+        ObjString *name = READ_STRING();
+        if (!peek(0).isObjType(ObjType::VM_INSTANCE)) {
+            throw RunTimeError(TOKEN(3), "Only instances have properties.");
+        }
+        auto instance = peek(0).asObj<VmInstance>();
+        if (int index = instance->shape->lookup(name); index >= 0) {
+            stackTop[-1] = instance->fields[index];
+            DISPATCH();
+        }
+        VmClosure *method = instance->klass->findMethod(name);
+        if (!method) {
+            throw RunTimeError(TOKEN(3), "Undefined property '" + TOKEN(3).lexeme + "'.");
+        }
+        stackTop[-1] = heap().allocate<VmBoundMethod>(instance, method);
+        DISPATCH();
+    }
+    CASE(OP_SET_PROPERTY): {
+        ObjString *name = READ_STRING();
+        if (!peek(1).isObjType(ObjType::VM_INSTANCE)) {
+            throw RunTimeError(TOKEN(3), "Only instances have properties.");
+        }
+        peek(1).asObj<VmInstance>()->set(name, peek(0));
+        Value value = pop();
+        stackTop[-1] = value;
+        DISPATCH();
+    }
+    CASE(OP_GET_SUPER): {
+        ObjString *name = READ_STRING();
+        auto superclass = pop().asObj<VmClass>();
+        VmClosure *method = superclass->findMethod(name);
+        if (!method) {
+            throw RunTimeError(TOKEN(3), "Undefined property " + TOKEN(3).lexeme + ".");
+        }
+        stackTop[-1] = heap().allocate<VmBoundMethod>(peek(0), method);
+        DISPATCH();
+    }
+    CASE(OP_EQUAL): {
+        Value rhs = pop();
+        stackTop[-1] = Value(isEqual(stackTop[-1], rhs));
+        DISPATCH();
+    }
+    CASE(OP_NOT_EQUAL): {
+        Value rhs = pop();
+        stackTop[-1] = Value(!isEqual(stackTop[-1], rhs));
+        DISPATCH();
+    }
+    CASE(OP_GREATER): {
+        BINARY_NUMBER_OP(>);
+        DISPATCH();
+    }
+    CASE(OP_GREATER_EQUAL): {
+        BINARY_NUMBER_OP(>=);
+        DISPATCH();
+    }
+    CASE(OP_LESS): {
+        BINARY_NUMBER_OP(<);
+        DISPATCH();
+    }
+    CASE(OP_LESS_EQUAL): {
+        BINARY_NUMBER_OP(<=);
+        DISPATCH();
+    }
+    CASE(OP_ADD): {
+        Value lhs = stackTop[-2];
+        Value rhs = stackTop[-1];
+        if (lhs.isNumber() && rhs.isNumber()) {
+            stackTop[-2] = Value(lhs.asNumber() + rhs.asNumber());
+        } else if (lhs.isString() && rhs.isString()) {
+            stackTop[-2] = concatenate(lhs.asString(), rhs.asString());
+        } else {
+            throw RunTimeError(TOKEN(1), "Operands must be two numbers or two strings.");
+        }
+        stackTop--;
+        DISPATCH();
+    }
+    CASE(OP_SUBTRACT): {
+        BINARY_NUMBER_OP(-);
+        DISPATCH();
+    }
+    CASE(OP_MULTIPLY): {
+        BINARY_NUMBER_OP(*);
+        DISPATCH();
+    }
+    CASE(OP_DIVIDE): {
+        if (stackTop[-1].isNumber() && stackTop[-1].asNumber() == 0.0 && stackTop[-2].isNumber()) {
+            throw RunTimeError(TOKEN(1), "Division by zero.");
+        }
+        BINARY_NUMBER_OP(/);
+        DISPATCH();
+    }
+    CASE(OP_NOT): {
+        stackTop[-1] = Value(!isTruthy(stackTop[-1]));
+        DISPATCH();
+    }
+    CASE(OP_NEGATE): {
+        if (!stackTop[-1].isNumber()) {
+            throw RunTimeError(TOKEN(1), "Operand must be number.");
+        }
+        stackTop[-1] = Value(-stackTop[-1].asNumber());
+        DISPATCH();
+    }
+    CASE(OP_PRINT): {
+        std::cout << stringify(pop()) << "\n";
+        DISPATCH();
+    }
+    CASE(OP_JUMP): {
+        int offset = READ_SHORT();
+        ip += offset;
+        DISPATCH();
+    }
+    CASE(OP_JUMP_IF_FALSE): {
+        int offset = READ_SHORT();
+        if (!isTruthy(peek(0))) {
+            ip += offset;
+        }
+        DISPATCH();
+    }
+    CASE(OP_LOOP): {
+        int offset = READ_SHORT();
+        ip -= offset;
+        // Loop back edges and calls are the VM's safepoints.
+        heap().safepoint();
+        DISPATCH();
+    }
+    CASE(OP_CALL): {
+        int argCount = READ_BYTE();
+        SAVE_FRAME();
+        heap().safepoint();
+        callValue(peek(argCount), argCount, TOKEN(2));
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    CASE(OP_INVOKE): {
+        ObjString *name = READ_STRING();
+        int argCount = READ_BYTE();
+        SAVE_FRAME();
+        heap().safepoint();
+        invoke(name, argCount, TOKEN(3), TOKEN(4));
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    CASE(OP_SUPER_INVOKE): {
+        ObjString *name = READ_STRING();
+        int argCount = READ_BYTE();
+        auto superclass = pop().asObj<VmClass>();
+        VmClosure *method = superclass->findMethod(name);
+        if (!method) {
+            throw RunTimeError(TOKEN(3), "Undefined property " + TOKEN(3).lexeme + ".");
+        }
+        SAVE_FRAME();
+        heap().safepoint();
+        call(method, argCount, TOKEN(4));
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    CASE(OP_CLOSURE): {
+        auto function = READ_CONSTANT().asObj<VmFunction>();
+        auto closure = heap().allocate<VmClosure>(function);
+        push(closure);
+        for (int i = 0; i < function->upvalueCount; i++) {
+            uint8_t isLocal = READ_BYTE();
+            uint8_t index = READ_BYTE();
+            closure->upvalues[i] = (isLocal ? captureUpvalue(slots + index) : frame->closure->upvalues[index]);
+        }
+        DISPATCH();
+    }
+    CASE(OP_CLOSE_UPVALUE): {
+        closeUpvalues(stackTop - 1);
+        stackTop--;
+        DISPATCH();
+    }
+    CASE(OP_RETURN): {
+        Value result = (frame->constructing ? slots[0] : pop());
+        closeUpvalues(slots);
+        frames.pop_back();
+        stackTop = slots;
+        if (frames.empty()) {
+            return;
+        }
+        push(result);
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    CASE(OP_CLASS): {
+        push(heap().allocate<VmClass>(READ_STRING()->flatten()));
+        DISPATCH();
+    }
+    CASE(OP_INHERIT): {
+        Value superclass = peek(1);
+        if (!superclass.isObjType(ObjType::VM_CLASS)) {
+            throw RunTimeError(TOKEN(1), "Superclass must be a class.");
+        }
+        auto subclass = peek(0).asObj<VmClass>();
+        subclass->methods = superclass.asObj<VmClass>()->methods;
+        subclass->initializer = superclass.asObj<VmClass>()->initializer;
+        stackTop--;
+        DISPATCH();
+    }
+    CASE(OP_METHOD): {
+        ObjString *name = READ_STRING();
+        auto klass = peek(1).asObj<VmClass>();
+        auto method = peek(0).asObj<VmClosure>();
+        klass->methods[name] = method;
+        if (name == names().init) {
+            klass->initializer = method;
+        }
+        stackTop--;
+        DISPATCH();
+    }
+
+#if !defined(__GNUC__)
+    }
+#endif
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef TOKEN
+#undef SAVE_FRAME
+#undef LOAD_FRAME
+#undef BINARY_NUMBER_OP
+#undef DISPATCH
+#undef CASE
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "objects.hpp"
+#include "../error/error_handler.hpp"
+#include "../interpreter/globals.hpp"
+
+struct CallFrame {
+    VmClosure *closure;
+    uint8_t *ip;
+    // The callee (or receiver) and the arguments start at this stack index.
+    size_t base;
+    // Set for an initializer run by a class call, which returns the instance.
+    bool constructing;
+};
+
+// Stack based bytecode interpreter, the alternative to the tree-walker
+// selected with --vm. Lox frames live on the heap, in a value stack and a
+// frame stack that grow until together they would exceed stackLimit bytes,
+// so recursion depth does not depend on the native stack.
+struct VM : GcRoots {
+    static const int INITIAL_SLOTS = 2048;
+
+    GlobalTable globals;
+    ErrorHandler &errorHandler;
+    Value *stack;
+    Value *stackTop;
+    size_t stackCapacity;
+    size_t stackLimit;
+    std::vector<CallFrame> frames;
+    // Upvalues still pointing into the stack, highest slot first.
+    VmUpvalue *openUpvalues;
+
+    VM(ErrorHandler &errorHandler);
+    ~VM();
+
+    void markRoots(Heap &heap) override;
+
+    void interpret(VmFunction *script);
+
+private:
+    void run();
+
+    void push(Value value) {
+        *stackTop++ = value;
+    }
+
+    Value pop() {
+        return *--stackTop;
+    }
+
+    Value peek(int distance) {
+        return stackTop[-1 - distance];
+    }
+
+    void defineNative(std::string name, int arity, NativeFn function);
+    void callValue(Value callee, int argCount, const Token &paren);
+    void call(VmClosure *closure, int argCount, const Token &paren, bool constructing = false);
+    void reserveFrame(size_t needed, const Token &paren);
+    void growStack(size_t capacity);
+    void invoke(ObjString *name, int argCount, const Token &nameToken, const Token &paren);
+    VmUpvalue *captureUpvalue(Value *local);
+    void closeUpvalues(Value *last);
+};
@@ -0,0 +1,13 @@
+#!/bin/sh
+# Runs a script the ahead-of-time way, translated by lox2cpp and built
+# against the runtime library, so tools/test.py can check it:
+#     python3 tools/test.py tools/aot_run.sh <lox2cpp> <libloxrt.a>
+translator=$1
+library=$2
+script=$3
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+"$translator" "$script" > "$dir/main.cpp" || exit $?
+${CXX:-g++} -std=c++17 -O1 -I "$(dirname "$0")/../lox" -o "$dir/main" "$dir/main.cpp" "$library" || exit 1
+"$dir/main"
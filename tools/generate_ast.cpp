@@ -29,7 +29,7 @@ std::vector<std::string> split(std::string s, char delimiter) {
     return words;
 }
 
-void defineType(std::string baseName, std::string className, std::string fields) {
+void defineType(std::string baseName, std::string className, std::string fields, std::string annotations) {
     className = className + baseName;
     std::cout << "struct " << className << " : public std::enable_shared_from_this<" << className << ">, " << baseName << " {\n";
 
@@ -38,6 +38,10 @@ void defineType(std::string baseName, std::string className, std::string fields)
     for (auto field : fieldList) {
         std::cout << "    " << field << ";\n";
     }
+    // Annotations are filled in after parsing and are not constructor parameters.
+    for (auto annotation : split(annotations, ',')) {
+        std::cout << "    " << annotation << ";\n";
+    }
     std::cout << "\n";
 
     // Constructor
@@ -91,41 +95,77 @@ void defineAst(std::string baseName, std::vector<std::string> types) {
     for (auto type : types) {
         auto colon = std::find(type.begin(), type.end(), ':');
         std::string className = trim(std::string(type.begin(), colon));
-        std::string fields = trim(std::string(colon + 1, type.end()));
-        defineType(baseName, className, fields);
+        auto bar = std::find(colon, type.end(), '|');
+        std::string fields = trim(std::string(colon + 1, bar));
+        std::string annotations = (bar == type.end() ? "" : trim(std::string(bar + 1, type.end())));
+        defineType(baseName, className, fields, annotations);
     }
 }
 
 int main() {
     std::cout << "#pragma once\n";
     std::cout << "#include <bits/stdc++.h>\n";
-    std::cout << "#include \"../lexer/token.hpp\"\n\n";
+    std::cout << "#include \"../lexer/token.hpp\"\n";
+    std::cout << "#include \"../runtime/inline_cache.hpp\"\n\n";
+
+    std::cout << "// Shape of the environment created for a block or a function call, computed by the resolver.\n";
+    std::cout << "struct FrameLayout {\n";
+    std::cout << "    // Number of names declared directly in the scope.\n";
+    std::cout << "    int numLocals = 0;\n";
+    std::cout << "    // Whether a closure can outlive the frame, which then has to live on the heap.\n";
+    std::cout << "    bool captured = false;\n";
+    std::cout << "};\n\n";
+
+    std::cout << "// Where the resolver found a local: the number of environments to walk up\n";
+    std::cout << "// and the index of the value in that environment. Depth -1 means not a local.\n";
+    std::cout << "struct LocalSlot {\n";
+    std::cout << "    int depth = -1;\n";
+    std::cout << "    int slot = 0;\n";
+    std::cout << "\n";
+    std::cout << "    bool isLocal() const {\n";
+    std::cout << "        return depth >= 0;\n";
+    std::cout << "    }\n";
+    std::cout << "};\n\n";
+
+    std::cout << "// Function body prepared once by the closure compiler.\n";
+    std::cout << "struct CompiledBody;\n";
+    std::cout << "// Native code for a function, owned by the JIT.\n";
+    std::cout << "struct JitEntry;\n\n";
+
+    std::cout << "// Operand types a binary operator has seen so far, which it specializes itself to at runtime.\n";
+    std::cout << "enum class Specialization {\n";
+    std::cout << "    UNINITIALIZED,\n";
+    std::cout << "    NUMBER,\n";
+    std::cout << "    STRING,\n";
+    std::cout << "    GENERIC\n";
+    std::cout << "};\n\n";
 
     defineAst("Expr", {
-        "Binary     : std::shared_ptr<Expr> lhs, Token op, std::shared_ptr<Expr> rhs",
+        "Binary     : std::shared_ptr<Expr> lhs, Token op, std::shared_ptr<Expr> rhs | bool numeric = false, Specialization specialization = Specialization::UNINITIALIZED",
         "Logical    : std::shared_ptr<Expr> lhs, Token op, std::shared_ptr<Expr> rhs",
-        "Unary      : Token op, std::shared_ptr<Expr> expr",
-        "Literal    : std::any value",
+        "Unary      : Token op, std::shared_ptr<Expr> expr | bool numeric = false",
+        "Literal    : Value value",
         "Grouping   : std::shared_ptr<Expr> expr",
-        "Variable   : Token name",
-        "Assignment : Token name, std::shared_ptr<Expr> expr",
-        "Call       : std::shared_ptr<Expr> callee, Token paren, std::vector<std::shared_ptr<Expr>> arguments",
-        "Get        : std::shared_ptr<Expr> object, Token name",
-        "Set        : std::shared_ptr<Expr> object, Token name, std::shared_ptr<Expr> value",
-        "This       : Token keyword",
-        "Super      : Token keyword, Token method"
+        "Variable   : Token name | LocalSlot local, int global = -1",
+        "Assignment : Token name, std::shared_ptr<Expr> expr | LocalSlot local, int global = -1",
+        "Call       : std::shared_ptr<Expr> callee, Token paren, std::vector<std::shared_ptr<Expr>> arguments | GetExpr *getCallee = nullptr",
+        "Get        : std::shared_ptr<Expr> object, Token name | InlineCache cache",
+        "Set        : std::shared_ptr<Expr> object, Token name, std::shared_ptr<Expr> value | InlineCache cache",
+        "This       : Token keyword | LocalSlot local",
+        "Super      : Token keyword, Token method | LocalSlot local"
     });
 
     defineAst("Stmt", {
         "Expression : std::shared_ptr<Expr> expr",
         "Print      : std::shared_ptr<Expr> expr",
         "Var        : Token name, std::shared_ptr<Expr> initializer",
-        "Block      : std::vector<std::shared_ptr<Stmt>> statements",
+        "Block      : std::vector<std::shared_ptr<Stmt>> statements | FrameLayout frame",
         "If         : std::shared_ptr<Expr> guard, std::shared_ptr<Stmt> then, std::shared_ptr<Stmt> elsee",
-        "While      : std::shared_ptr<Expr> cond, std::shared_ptr<Stmt> body, bool isDesugaredFor",
-        "Function   : Token name, std::vector<Token> parameters, std::vector<std::shared_ptr<Stmt>> body",
+        "While      : std::shared_ptr<Expr> cond, std::shared_ptr<Stmt> body",
+        "For        : std::shared_ptr<Stmt> initializer, std::shared_ptr<Expr> cond, std::shared_ptr<Expr> increment, std::shared_ptr<Stmt> body | FrameLayout frame, bool counted = false, bool counterRead = false",
+        "Function   : Token name, std::vector<Token> parameters, std::vector<std::shared_ptr<Stmt>> body | FrameLayout frame, std::shared_ptr<CompiledBody> compiled, std::shared_ptr<JitEntry> native",
         "Class      : Token name, std::shared_ptr<VariableExpr> superclass, std::vector<std::shared_ptr<FunctionStmt>> methods",
-        "Return     : Token keyword, std::shared_ptr<Expr> expr",
+        "Return     : Token keyword, std::shared_ptr<Expr> expr | bool tailCall = false",
         "Break      : Token keyword",
         "Continue   : Token keyword"
     });
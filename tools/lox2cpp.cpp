@@ -0,0 +1,708 @@
+#include <bits/stdc++.h>
+
+#include "../lox/error/error_handler.hpp"
+#include "../lox/lexer/scanner.hpp"
+#include "../lox/parser/parser.hpp"
+#include "../lox/analysis/resolver.hpp"
+#include "../lox/analysis/optimizer.hpp"
+
+// Translates a Lox program ahead of time into a C++ program built on the
+// runtime in lox/aot:
+//
+//     lox2cpp script.lox > script.cpp
+//     g++ -std=c++17 -O2 -I lox -o script script.cpp <build>/libloxrt.a
+//
+// Each Lox function becomes a C++ function over a window of the runtime's
+// value stack (see lox/aot/runtime.hpp). Locals live in window slots, or in
+// a heap environment when the resolver found the scope captured, and every
+// intermediate value goes to a window slot, so all of them are roots.
+
+struct Translator : VisitorExpr, VisitorStmt {
+    // A value usable as a C++ expression. Unstable operands read a variable
+    // and have to be copied before anything else runs.
+    struct Operand {
+        std::string code;
+        bool stable;
+    };
+
+    struct Scope {
+        int function;
+        bool onHeap;
+        // First slot of the scope's locals in the window, or the C++ name of its environment.
+        int base;
+        std::string environment;
+        // Locals declared so far, which is the slot of the next one.
+        int defined;
+    };
+
+    struct Loop {
+        int id;
+        // Whether continue has to run an increment first.
+        bool increments;
+        bool continued;
+    };
+
+    struct Function {
+        int id;
+        Function *enclosing;
+        // Index of the function's own scope in scopes.
+        int scope;
+        std::string code;
+        int indent;
+        int slots;
+        int frameSize;
+        std::vector<Loop> loops;
+    };
+
+    struct Proto {
+        std::string name;
+        int arity;
+        int frameSize;
+    };
+
+    GlobalTable &globals;
+    ErrorHandler &errorHandler;
+    std::vector<Scope> scopes;
+    Function *current;
+    std::vector<Proto> protos;
+    std::vector<std::string> functions;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, int> stringIndices;
+    int numCaches;
+    int numLoops;
+    Operand result;
+    // Slots in use when the expression being translated started, and where its value should go (or -1).
+    int mark;
+    int destination;
+
+    Translator(GlobalTable &globals, ErrorHandler &errorHandler) : globals(globals), errorHandler(errorHandler), current(nullptr), numCaches(0), numLoops(0), mark(0), destination(-1) {}
+
+    std::string translate(const std::vector<std::shared_ptr<Stmt>> &statements, int clockSlot);
+
+    void emit(const std::string &line) {
+        current->code += std::string(4 * current->indent, ' ') + line + "\n";
+    }
+
+    // Placeholder for the window size, known once the whole function is translated.
+    static std::string frameSize() {
+        return "@FRAME_SIZE@";
+    }
+
+    int allocate(int count) {
+        int slot = current->slots;
+        current->slots += count;
+        current->frameSize = std::max(current->frameSize, current->slots);
+        return slot;
+    }
+
+    static std::string slot(int index) {
+        return "frame[" + std::to_string(index) + "]";
+    }
+
+    Operand temp(const std::string &value) {
+        std::string target = slot(allocate(1));
+        emit(target + " = " + value + ";");
+        return {target, true};
+    }
+
+    Operand stable(Operand operand) {
+        return operand.stable ? operand : temp(operand.code);
+    }
+
+    // Stores the value of the expression being translated. Its operands are
+    // dead by then, so their temporaries are reused.
+    Operand value(const std::string &value) {
+        if (destination >= 0) {
+            current->slots = mark;
+            std::string target = slot(destination);
+            emit(target + " = " + value + ";");
+            return {target, true};
+        }
+        current->slots = mark;
+        return temp(value);
+    }
+
+    int string(const std::string &chars) {
+        auto [it, inserted] = stringIndices.insert({chars, int(strings.size())});
+        if (inserted) {
+            strings.push_back(chars);
+        }
+        return it->second;
+    }
+
+    std::string stringConstant(const std::string &chars) {
+        return "constants[" + std::to_string(string(chars)) + "]";
+    }
+
+    std::string cache() {
+        return "caches[" + std::to_string(numCaches++) + "]";
+    }
+
+    static std::string line(const Token &token) {
+        return std::to_string(token.line);
+    }
+
+    static std::string number(double value) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%a", value);
+        return buffer;
+    }
+
+    Operand compile(const std::shared_ptr<Expr> &expr, int into = -1) {
+        int savedMark = mark;
+        int savedDestination = destination;
+        mark = current->slots;
+        destination = into;
+        expr->accept(*this);
+        mark = savedMark;
+        destination = savedDestination;
+        if (into >= 0 && result.code != slot(into)) {
+            emit(slot(into) + " = " + result.code + ";");
+            result = {slot(into), true};
+        }
+        return result;
+    }
+
+    void compile(const std::shared_ptr<Stmt> &stmt) {
+        // Temporaries die with the statement.
+        int slots = current->slots;
+        stmt->accept(*this);
+        current->slots = slots;
+    }
+
+    // Expressions that only read a constant or a local: evaluating them
+    // emits no code, so the other operand need not be copied first.
+    static bool isSimple(const std::shared_ptr<Expr> &expr) {
+        if (auto grouping = std::dynamic_pointer_cast<GroupingExpr>(expr); grouping) {
+            return isSimple(grouping->expr);
+        } else if (auto variable = std::dynamic_pointer_cast<VariableExpr>(expr); variable) {
+            return variable->local.isLocal();
+        }
+        return std::dynamic_pointer_cast<LiteralExpr>(expr) || std::dynamic_pointer_cast<ThisExpr>(expr);
+    }
+
+    std::pair<Operand, Operand> operands(const std::shared_ptr<Expr> &lhs, const std::shared_ptr<Expr> &rhs) {
+        Operand left = compile(lhs);
+        if (!isSimple(rhs)) {
+            left = stable(left);
+        }
+        Operand right = compile(rhs);
+        return {left, right};
+    }
+
+    // A C++ condition for a statement, comparisons avoiding a boxed boolean.
+    std::string condition(const std::shared_ptr<Expr> &expr) {
+        if (auto grouping = std::dynamic_pointer_cast<GroupingExpr>(expr); grouping) {
+            return condition(grouping->expr);
+        } else if (auto unary = std::dynamic_pointer_cast<UnaryExpr>(expr); unary && unary->op.type == TokenType::BANG) {
+            return "!(" + condition(unary->expr) + ")";
+        } else if (auto binary = std::dynamic_pointer_cast<BinaryExpr>(expr); binary) {
+            if (std::string test = comparison(binary); !test.empty()) {
+                return test;
+            }
+        }
+        return "isTruthy(" + compile(expr).code + ")";
+    }
+
+    std::string comparison(const std::shared_ptr<BinaryExpr> &expr) {
+        std::string function;
+        switch (expr->op.type) {
+            case TokenType::LESS: function = "less"; break;
+            case TokenType::LESS_EQUAL: function = "lessEqual"; break;
+            case TokenType::GREATER: function = "greater"; break;
+            case TokenType::GREATER_EQUAL: function = "greaterEqual"; break;
+            case TokenType::EQUAL_EQUAL:
+            case TokenType::BANG_EQUAL: {
+                auto [lhs, rhs] = operands(expr->lhs, expr->rhs);
+                return std::string(expr->op.type == TokenType::BANG_EQUAL ? "!" : "") + "isEqual(" + lhs.code + ", " + rhs.code + ")";
+            }
+            default:
+                return "";
+        }
+        auto [lhs, rhs] = operands(expr->lhs, expr->rhs);
+        return function + "(" + lhs.code + ", " + rhs.code + ", " + line(expr->op) + ")";
+    }
+
+    // Where the variable in slot of the scope depth scopes out is stored.
+    std::string variable(LocalSlot local) {
+        int index = scopes.size() - 1 - local.depth;
+        Scope &scope = scopes[index];
+        std::string slotIndex = std::to_string(local.slot);
+        if (scope.function == current->id) {
+            return scope.onHeap ? scope.environment + "->values[" + slotIndex + "]" : slot(scope.base + local.slot);
+        }
+        // Captured from an enclosing function, through the chain of environments.
+        std::string path = "self->closure";
+        for (int i = current->scope - 1; i > index; i--) {
+            if (scopes[i].onHeap) {
+                path += "->enclosing";
+            }
+        }
+        return path + "->values[" + slotIndex + "]";
+    }
+
+    // The innermost environment, which new closures and environments enclose.
+    std::string environment() {
+        for (int i = scopes.size() - 1; i >= 0 && scopes[i].function == current->id; i--) {
+            if (scopes[i].onHeap) {
+                return scopes[i].environment;
+            }
+        }
+        return current->enclosing ? "self->closure" : "nullptr";
+    }
+
+    void beginScope(const FrameLayout &frame, int defined) {
+        Scope scope{current->id, frame.captured, 0, "", defined};
+        if (frame.captured) {
+            scope.environment = "e" + std::to_string(scopes.size());
+            emit("AotEnvironment *" + scope.environment + " = AotEnvironment::create(" + environment() + ", " + std::to_string(frame.numLocals) + ");");
+            emit(slot(allocate(1)) + " = " + scope.environment + ";");
+        } else {
+            scope.base = allocate(frame.numLocals);
+        }
+        scopes.push_back(scope);
+    }
+
+    // Stores a value in the variable being declared.
+    void declare(const Token &name, const std::string &value) {
+        if (scopes.empty()) {
+            emit("defineGlobal(" + std::to_string(globals.slot(name.identifier())) + ", " + value + ");");
+        } else {
+            emit(variable({0, scopes.back().defined++}) + " = " + value + ";");
+        }
+    }
+
+    int compileFunction(const std::shared_ptr<FunctionStmt> &stmt, bool isMethod);
+
+    void visitLiteralExpr(std::shared_ptr<LiteralExpr> expr) override {
+        Value value = expr->value;
+        if (value.isNumber()) {
+            result = {"Value(" + number(value.asNumber()) + ")", true};
+        } else if (value.isBool()) {
+            result = {value.asBool() ? "Value(true)" : "Value(false)", true};
+        } else if (value.isString()) {
+            result = {"Value(" + stringConstant(value.asString()->flatten()) + ")", true};
+        } else {
+            result = {"Value()", true};
+        }
+    }
+
+    void visitGroupingExpr(std::shared_ptr<GroupingExpr> expr) override {
+        result = compile(expr->expr);
+    }
+
+    void visitBinaryExpr(std::shared_ptr<BinaryExpr> expr) override {
+        if (std::string test = comparison(expr); !test.empty()) {
+            result = value("Value(" + test + ")");
+            return;
+        }
+        std::string function;
+        switch (expr->op.type) {
+            case TokenType::PLUS: function = "add"; break;
+            case TokenType::MINUS: function = "subtract"; break;
+            case TokenType::STAR: function = "multiply"; break;
+            case TokenType::SLASH: function = "divide"; break;
+            default:
+                assert(0);
+        }
+        auto [lhs, rhs] = operands(expr->lhs, expr->rhs);
+        result = value(function + "(" + lhs.code + ", " + rhs.code + ", " + line(expr->op) + ")");
+    }
+
+    void visitLogicalExpr(std::shared_ptr<LogicalExpr> expr) override {
+        Operand lhs = compile(expr->lhs);
+        Operand result = value(lhs.code);
+        emit(std::string(expr->op.type == TokenType::OR ? "if (!isTruthy(" : "if (isTruthy(") + result.code + ")) {");
+        current->indent++;
+        emit(result.code + " = " + compile(expr->rhs).code + ";");
+        current->indent--;
+        emit("}");
+        this->result = result;
+    }
+
+    void visitUnaryExpr(std::shared_ptr<UnaryExpr> expr) override {
+        Operand operand = compile(expr->expr);
+        if (expr->op.type == TokenType::MINUS) {
+            result = value("negate(" + operand.code + ", " + line(expr->op) + ")");
+        } else {
+            result = value("Value(!isTruthy(" + operand.code + "))");
+        }
+    }
+
+    void visitVariableExpr(std::shared_ptr<VariableExpr> expr) override {
+        if (expr->local.isLocal()) {
+            result = {variable(expr->local), false};
+        } else {
+            result = value("getGlobal(" + std::to_string(expr->global) + ", " + line(expr->name) + ")");
+        }
+    }
+
+    void visitAssignmentExpr(std::shared_ptr<AssignmentExpr> expr) override {
+        Operand value = compile(expr->expr);
+        if (expr->local.isLocal()) {
+            std::string target = variable(expr->local);
+            emit(target + " = " + value.code + ";");
+            result = {target, false};
+        } else {
+            emit("setGlobal(" + std::to_string(expr->global) + ", " + value.code + ", " + line(expr->name) + ");");
+            result = value;
+        }
+    }
+
+    // The callee (or receiver) and the arguments go to consecutive slots
+    // above every live temporary, where the callee's window starts.
+    void visitCallExpr(std::shared_ptr<CallExpr> expr) override {
+        int argCount = expr->arguments.size();
+        int base = allocate(argCount + 1);
+        std::string method;
+        auto get = std::dynamic_pointer_cast<GetExpr>(expr->callee);
+        if (get) {
+            // Properties are looked up before the arguments are evaluated; a method is invoked unbound.
+            method = slot(allocate(1));
+            compile(get->object, base);
+            emit(method + " = lookUpMethod(frame + " + std::to_string(base) + ", " + stringConstant(get->name.lexeme) + ", " + cache() + ", " + line(get->name) + ");");
+        } else {
+            compile(expr->callee, base);
+        }
+        for (int i = 0; i < argCount; i++) {
+            compile(expr->arguments[i], base + 1 + i);
+        }
+
+        std::string window = "frame + " + std::to_string(base);
+        std::string rest = std::to_string(argCount) + ", " + line(expr->paren) + ")";
+        if (get) {
+            result = value(method + ".isNil() ? call(" + window + ", " + rest + " : callFunction(" + method + ".asObj<AotFunction>(), " + window + ", " + rest);
+        } else {
+            result = value("call(" + window + ", " + rest);
+        }
+    }
+
+    void visitGetExpr(std::shared_ptr<GetExpr> expr) override {
+        Operand object = compile(expr->object);
+        result = value("getProperty(" + object.code + ", " + stringConstant(expr->name.lexeme) + ", " + cache() + ", " + line(expr->name) + ")");
+    }
+
+    void visitSetExpr(std::shared_ptr<SetExpr> expr) override {
+        Operand object = compile(expr->object);
+        if (!isSimple(expr->value)) {
+            object = stable(object);
+        }
+        std::string name = stringConstant(expr->name.lexeme);
+        emit("requireInstance(" + object.code + ", " + name + ", " + line(expr->name) + ");");
+        Operand value = compile(expr->value);
+        emit("setProperty(" + object.code + ", " + name + ", " + value.code + ", " + cache() + ");");
+        result = value;
+    }
+
+    void visitThisExpr(std::shared_ptr<ThisExpr> expr) override {
+        if (!expr->local.isLocal()) {
+            // Outside of a class 'this' is an undefined variable, as in the interpreters.
+            result = value("getGlobal(" + std::to_string(globals.slot(expr->keyword.identifier())) + ", " + line(expr->keyword) + ")");
+            return;
+        }
+        result = {variable(expr->local), false};
+    }
+
+    void visitSuperExpr(std::shared_ptr<SuperExpr> expr) override {
+        if (!expr->local.isLocal()) {
+            errorHandler.error(expr->keyword, "'super' not in the subclass.");
+            result = {"Value()", true};
+            return;
+        }
+        // 'this' is bound in the scope just inside the one holding 'super'.
+        std::string superclass = variable(expr->local);
+        std::string receiver = variable({expr->local.depth - 1, 0});
+        result = value("getSuper(" + superclass + ", " + receiver + ", " + stringConstant(expr->method.lexeme) + ", " + line(expr->method) + ")");
+    }
+
+    void visitBreakStmt(std::shared_ptr<BreakStmt> stmt) override {
+        if (current->loops.empty()) {
+            errorHandler.error(stmt->keyword, current->enclosing ? "Break statement at the function level." : "Break statement at the top level.");
+            return;
+        }
+        emit("break;");
+    }
+
+    void visitContinueStmt(std::shared_ptr<ContinueStmt> stmt) override {
+        if (current->loops.empty()) {
+            errorHandler.error(stmt->keyword, current->enclosing ? "Continue statement at the function level." : "Continue statement at the top level.");
+            return;
+        }
+        Loop &loop = current->loops.back();
+        if (loop.increments) {
+            // The increment still runs.
+            loop.continued = true;
+            emit("goto next" + std::to_string(loop.id) + ";");
+        } else {
+            emit("continue;");
+        }
+    }
+
+    void visitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override {
+        compile(stmt->expr);
+    }
+
+    void visitPrintStmt(std::shared_ptr<PrintStmt> stmt) override {
+        emit("print(" + compile(stmt->expr).code + ");");
+    }
+
+    void visitVarStmt(std::shared_ptr<VarStmt> stmt) override {
+        if (!stmt->initializer) {
+            declare(stmt->name, "Value()");
+        } else if (!scopes.empty() && !scopes.back().onHeap) {
+            // The variable cannot be read in its own initializer, so its slot is written directly.
+            compile(stmt->initializer, scopes.back().base + scopes.back().defined++);
+        } else {
+            declare(stmt->name, compile(stmt->initializer).code);
+        }
+    }
+
+    void visitBlockStmt(std::shared_ptr<BlockStmt> stmt) override {
+        emit("{");
+        current->indent++;
+        beginScope(stmt->frame, 0);
+        for (auto &statement : stmt->statements) {
+            compile(statement);
+        }
+        scopes.pop_back();
+        current->indent--;
+        emit("}");
+    }
+
+    void visitIfStmt(std::shared_ptr<IfStmt> stmt) override {
+        emit("if (" + condition(stmt->guard) + ") {");
+        current->indent++;
+        compile(stmt->then);
+        current->indent--;
+        if (stmt->elsee) {
+            emit("} else {");
+            current->indent++;
+            compile(stmt->elsee);
+            current->indent--;
+        }
+        emit("}");
+    }
+
+    void visitWhileStmt(std::shared_ptr<WhileStmt> stmt) override {
+        int id = numLoops++;
+        emit("while (true) {");
+        current->indent++;
+        emit("heap().safepoint();");
+        emit("if (!(" + condition(stmt->cond) + ")) break;");
+        current->loops.push_back({id, false, false});
+        compile(stmt->body);
+        current->loops.pop_back();
+        current->indent--;
+        emit("}");
+    }
+
+    void visitForStmt(std::shared_ptr<ForStmt> stmt) override {
+        int id = numLoops++;
+        emit("{");
+        current->indent++;
+        beginScope(stmt->frame, 0);
+        if (stmt->initializer) {
+            compile(stmt->initializer);
+        }
+        emit("while (true) {");
+        current->indent++;
+        emit("heap().safepoint();");
+        if (stmt->cond) {
+            emit("if (!(" + condition(stmt->cond) + ")) break;");
+        }
+        current->loops.push_back({id, stmt->increment != nullptr, false});
+        compile(stmt->body);
+        if (current->loops.back().continued) {
+            emit("next" + std::to_string(id) + ":;");
+        }
+        if (stmt->increment) {
+            compile(stmt->increment);
+        }
+        current->loops.pop_back();
+        current->indent--;
+        emit("}");
+        scopes.pop_back();
+        current->indent--;
+        emit("}");
+    }
+
+    void visitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override {
+        int proto = compileFunction(stmt, false);
+        declare(stmt->name, "heap().allocate<AotFunction>(&protos[" + std::to_string(proto) + "], " + environment() + ")");
+    }
+
+    void visitClassStmt(std::shared_ptr<ClassStmt> stmt) override {
+        emit("{");
+        current->indent++;
+        std::string superclass = "Value()";
+        std::string superName = "nullptr";
+        if (stmt->superclass) {
+            superclass = stable(compile(stmt->superclass)).code;
+            superName = "\"" + stmt->superclass->name.lexeme + "\"";
+        }
+        std::string klass = "k" + std::to_string(scopes.size());
+        emit("AotClass *" + klass + " = newClass(\"" + stmt->name.lexeme + "\", " + superclass + ", " + superName + ", " + line(stmt->superclass ? stmt->superclass->name : stmt->name) + ");");
+        emit(slot(allocate(1)) + " = " + klass + ";");
+
+        if (stmt->superclass) {
+            // The scope holding 'super', enclosing the methods.
+            beginScope(FrameLayout{1, true}, 1);
+            emit(scopes.back().environment + "->values[0] = " + superclass + ";");
+        }
+        for (auto &method : stmt->methods) {
+            int proto = compileFunction(method, true);
+            emit("defineMethod(" + klass + ", " + stringConstant(method->name.lexeme) + ", heap().allocate<AotFunction>(&protos[" + std::to_string(proto) + "], " + environment() + "));");
+        }
+        if (stmt->superclass) {
+            scopes.pop_back();
+        }
+        declare(stmt->name, klass);
+        current->indent--;
+        emit("}");
+    }
+
+    void visitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override {
+        if (!current->enclosing) {
+            errorHandler.error(stmt->keyword, "Return statement at the top level.");
+            return;
+        }
+        std::string value = stmt->expr ? compile(stmt->expr).code : "Value()";
+        emit("return leave(frame, " + frameSize() + ", " + value + ");");
+    }
+};
+
+int Translator::compileFunction(const std::shared_ptr<FunctionStmt> &stmt, bool isMethod) {
+    int id = protos.size();
+    protos.push_back({stmt->name.lexeme, int(stmt->parameters.size()), 0});
+    int arity = stmt->parameters.size() + (isMethod ? 1 : 0);
+    Function function{id, current, int(scopes.size()), "", 1, arity, arity, {}};
+    current = &function;
+
+    // The arguments are already in the first slots of the window.
+    const FrameLayout &frame = stmt->frame;
+    if (frame.captured) {
+        beginScope(frame, arity);
+        for (int i = 0; i < arity; i++) {
+            emit(scopes.back().environment + "->values[" + std::to_string(i) + "] = " + slot(i) + ";");
+        }
+    } else {
+        current->slots = 0;
+        beginScope(frame, arity);
+    }
+    for (auto &statement : stmt->body) {
+        compile(statement);
+    }
+    emit("return leave(frame, " + frameSize() + ", Value());");
+    scopes.pop_back();
+    current = function.enclosing;
+
+    std::string code = function.code;
+    std::string size = std::to_string(function.frameSize);
+    for (size_t at = code.find(frameSize()); at != std::string::npos; at = code.find(frameSize(), at)) {
+        code.replace(at, frameSize().size(), size);
+    }
+    functions.push_back("// " + stmt->name.lexeme + "\nstatic Value fn" + std::to_string(id) + "(AotFunction *self, Value *frame) {\n" + code + "}\n");
+    protos[id].frameSize = function.frameSize;
+    return id;
+}
+
+static std::string quote(const std::string &chars) {
+    std::string quoted = "\"";
+    for (unsigned char c : chars) {
+        if (std::isprint(c) && c != '"' && c != '\\' && c != '?') {
+            quoted += c;
+        } else {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\%03o", c);
+            quoted += escape;
+        }
+    }
+    return quoted + "\"";
+}
+
+std::string Translator::translate(const std::vector<std::shared_ptr<Stmt>> &statements, int clockSlot) {
+    protos.push_back({"script", 0, 0});
+    Function script{0, nullptr, 0, "", 1, 0, 0, {}};
+    current = &script;
+    for (auto &statement : statements) {
+        compile(statement);
+    }
+    current = nullptr;
+
+    std::ostringstream out;
+    out << "// Generated by lox2cpp.\n";
+    out << "#include \"aot/runtime.hpp\"\n\n";
+    out << "static ObjString *constants[" << std::max<size_t>(strings.size(), 1) << "];\n";
+    out << "static AotCache caches[" << std::max(numCaches, 1) << "];\n";
+    out << "static const char *const globalNames[] = {";
+    for (auto name : globals.names) {
+        out << quote(name->chars) << ", ";
+    }
+    out << "nullptr};\n\n";
+
+    for (int i = 1; i < int(protos.size()); i++) {
+        out << "static Value fn" << i << "(AotFunction *self, Value *frame);\n";
+    }
+    out << "\nstatic const AotProto protos[] = {\n";
+    out << "    {nullptr, \"script\", 0, 0},\n";
+    for (int i = 1; i < int(protos.size()); i++) {
+        out << "    {fn" << i << ", " << quote(protos[i].name) << ", " << protos[i].arity << ", " << protos[i].frameSize << "},\n";
+    }
+    out << "};\n\n";
+    for (auto &function : functions) {
+        out << function << "\n";
+    }
+
+    out << "static Value clockNative(int argCount, Value *args) {\n";
+    out << "    return double(time(0));\n";
+    out << "}\n\n";
+    out << "int main() {\n";
+    out << "    runtime.init(" << globals.names.size() << ", globalNames);\n";
+    for (int i = 0; i < int(strings.size()); i++) {
+        out << "    constants[" << i << "] = heap().pin(intern(std::string(" << quote(strings[i]) << ", " << strings[i].size() << ")));\n";
+    }
+    out << "    runtime.defineNative(" << clockSlot << ", \"clock\", 0, clockNative);\n\n";
+    out << "    Value *frame = runtime.stack;\n";
+    out << "    runtime.highWater = frame + " << script.frameSize << ";\n";
+    out << script.code;
+    out << "    return 0;\n";
+    out << "}\n";
+    return out.str();
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " script.lox\n";
+        return 64;
+    }
+    std::ifstream file(argv[1]);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string source = buffer.str();
+
+    ErrorHandler errorHandler;
+    GlobalTable globals;
+    int clockSlot = globals.slot(intern("clock"));
+
+    Scanner scanner(source, errorHandler);
+    auto tokens = scanner.scanTokens();
+    if (errorHandler.hadError) return 65;
+
+    Parser parser(tokens, errorHandler);
+    auto statements = parser.parse();
+    if (errorHandler.hadError) return 65;
+
+    Resolver resolver(globals, errorHandler);
+    resolver.resolve(statements);
+    if (errorHandler.hadError) return 65;
+
+    Optimizer optimizer;
+    optimizer.optimize(statements);
+
+    Translator translator(globals, errorHandler);
+    std::string program = translator.translate(statements, clockSlot);
+    if (errorHandler.hadError) return 65;
+
+    std::cout << program;
+    return 0;
+}